@@ -15,7 +15,15 @@ REM copy %LIBDIR%\SDL3.dll .
 
 pushd bin
 cl %FLAGS% %SRC% SDL3.lib %FLAGS% %INCDIR% /link %LDFLAGS% /LIBPATH:%LIBDIR% %LIBS%
+cl %FLAGS% ..\src\bench.c SDL3.lib %FLAGS% %INCDIR% /link %LDFLAGS% /LIBPATH:%LIBDIR% %LIBS%
 popd
 
 %BINDIR%\shadercross.exe shaders\2d.vert.hlsl -o shaders\2d.vert.spv
 %BINDIR%\shadercross.exe shaders\2d.frag.hlsl -o shaders\2d.frag.spv
+%BINDIR%\shadercross.exe shaders\2d_quad.vert.hlsl -o shaders\2d_quad.vert.spv
+%BINDIR%\shadercross.exe shaders\2d_uber.frag.hlsl -o shaders\2d_uber.frag.spv
+%BINDIR%\shadercross.exe shaders\2d_solid.frag.hlsl -o shaders\2d_solid.frag.spv
+%BINDIR%\shadercross.exe shaders\2d_sdf.frag.hlsl -o shaders\2d_sdf.frag.spv
+%BINDIR%\shadercross.exe shaders\2d_sprite.frag.hlsl -o shaders\2d_sprite.frag.spv
+%BINDIR%\shadercross.exe shaders\2d_glyph.frag.hlsl -o shaders\2d_glyph.frag.spv
+%BINDIR%\shadercross.exe shaders\cull.comp.hlsl -o shaders\cull.comp.spv
@@ -0,0 +1,123 @@
+// Shared by 2d_quad.vert.hlsl, the 2d_*.frag.hlsl pipelines and cull.comp.hlsl
+
+// Keep in sync with QUAD_* in platform.h
+static const uint QUAD_TEXTURED = 1 << 0;
+static const uint QUAD_BORDER = 1 << 1;
+static const uint QUAD_PRIM_MASK = 3 << 2;
+static const uint QUAD_PRIM_LINE = 1 << 2;
+static const uint QUAD_PRIM_ARC = 2 << 2;
+static const uint QUAD_CAP_SHIFT = 4;
+static const uint QUAD_PREMULTIPLY = 1 << 6;
+static const uint QUAD_SLOT_SHIFT = 8;
+static const uint QUAD_CLIP_SHIFT = 16;
+
+// Packed layout of GpuQuad in platform.h (48 bytes)
+struct VertexData {
+    float4 dst_rect;
+    uint2 src_rect;         // unorm16 x4
+    uint2 corner_radii;     // half x4
+    uint color;             // RGBA8
+    uint border_color;      // RGBA8
+    uint border_transform;  // half border_thickness, transform index
+    uint flags;             // QUAD_* bits, texture slot in bits 8-11, clip in 16-31
+};
+
+// GpuTransform in platform_sdl3.c. A point p of the quad's rect goes to
+// m.xy * p.x + m.zw * p.y + t.
+struct Transform {
+    float4 m;
+    float2 t;
+    float2 padding;
+};
+
+// LineCap in platform.h
+static const uint LINE_CAP_ROUND = 1;
+static const uint LINE_CAP_SQUARE = 2;
+
+// SDF sizes are in screen units and constant per quad, so the vertex stage
+// works them out once instead of every pixel doing it.
+struct Varyings {
+    float4 color : COLOR;
+    float4 border_color : BCOLOR;
+    float4 position : SV_Position;
+    float4 clip_distance : SV_ClipDistance0;            // clips transformed quads that aren't axis aligned
+    float2 tex_coord : TEXCOORD0;
+    float2 local : LOCAL;                                // position relative to the quad's center
+    nointerpolation float4 half_sizes : HALFSIZES;       // outer xy, inner zw
+    nointerpolation float4 corner_radii : RADII;
+    nointerpolation float4 inner_radii : INNERRADII;
+    nointerpolation float4 shape : SHAPE;                // line endpoints, or arc rotation and aperture
+    nointerpolation float2 aa : AA;                      // smoothstep widths, outer and inner
+    nointerpolation uint flags : FLAGS;
+};
+
+float sdf_rounded_box(float2 p, float2 b, float4 r) {
+    r.xy = (p.x>0.0)?r.xy : r.zw;
+    r.x  = (p.y>0.0)?r.x  : r.y;
+    float2 q = abs(p)-b+r.x;
+    return min(max(q.x,q.y),0.0) + length(max(q,0.0)) - r.x;
+}
+
+float sdf_segment(float2 p, float2 a, float2 b, float r, uint cap) {
+    float2 ba = b - a;
+    if (cap == LINE_CAP_ROUND) {
+        float h = saturate(dot(p - a, ba) / max(dot(ba, ba), 1e-6));
+        return length(p - a - ba * h) - r;
+    }
+    float len = length(ba);
+    float2 dir = len > 0 ? ba / len : float2(1, 0);
+    float2 pc = p - (a + b) / 2;
+    float2 q = abs(float2(dot(pc, dir), dot(pc, float2(-dir.y, dir.x))));
+    q -= float2(len / 2 + (cap == LINE_CAP_SQUARE ? r : 0), r);
+    return length(max(q, 0.0)) + min(max(q.x, q.y), 0.0);
+}
+
+// shape.xy turns the arc to be centered on +y, shape.zw is the sin and cos
+// of half its sweep. radii is the centerline radius and half the thickness,
+// or the radius and 0 for a pie. After Inigo Quilez's sdArc and sdPie.
+float sdf_arc(float2 p, float4 shape, float2 radii) {
+    p = float2(p.x * shape.y - p.y * shape.x, p.x * shape.x + p.y * shape.y);
+    p.x = abs(p.x);
+    float2 sc = shape.zw;
+    if (radii.y > 0) {
+        return (sc.y * p.x > sc.x * p.y ? length(p - sc * radii.x) : abs(length(p) - radii.x)) - radii.y;
+    }
+    float l = length(p) - radii.x;
+    if (sc.y < -0.999) {
+        return l;
+    }
+    float m = length(p - sc * clamp(dot(p, sc), 0.0, radii.x));
+    return max(l, m * sign(sc.y * p.x - sc.x * p.y));
+}
+
+float4 shade_sdf(Varyings input) {
+    uint prim = input.flags & QUAD_PRIM_MASK;
+    if (prim != 0) {
+        float d = prim == QUAD_PRIM_LINE
+            ? sdf_segment(input.local, input.shape.xy, input.shape.zw, input.half_sizes.x, (input.flags >> QUAD_CAP_SHIFT) & 3)
+            : sdf_arc(input.local, input.shape, input.half_sizes.xy);
+        return float4(input.color.rgb, input.color.a * (1 - smoothstep(0, input.aa.x, d)));
+    }
+
+    float d = sdf_rounded_box(input.local, input.half_sizes.xy, input.corner_radii);
+    float coverage = 1 - smoothstep(0, input.aa.x, d);
+    if (!(input.flags & QUAD_BORDER)) {
+        return float4(input.color.rgb, input.color.a * coverage);
+    }
+
+    float d2 = sdf_rounded_box(input.local, input.half_sizes.zw, input.inner_radii);
+    return lerp(
+        float4(input.border_color.rgb, coverage * input.border_color.a),
+        input.color,
+        1 - smoothstep(0, input.aa.y, d2)
+    );
+}
+
+// Multiplied quads are blended as dst * src + dst * (1 - a), so they fade to
+// the destination only with their color premultiplied
+float4 finish(Varyings input, float4 color) {
+    if (input.flags & QUAD_PREMULTIPLY) {
+        color.rgb *= color.a;
+    }
+    return color;
+}
@@ -0,0 +1,7 @@
+#include "2d_common.hlsli"
+#include "2d_textures.hlsli"
+
+// Font atlases are white with coverage in alpha
+float4 main(Varyings input) : SV_Target0 {
+    return finish(input, float4(input.color.rgb, input.color.a * sample_quad(input).a));
+}
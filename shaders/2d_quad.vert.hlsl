@@ -0,0 +1,151 @@
+#include "2d_common.hlsli"
+
+StructuredBuffer<VertexData> data : register(t0, space0);
+StructuredBuffer<uint> order : register(t1, space0);
+StructuredBuffer<float4> clips : register(t2, space0);
+StructuredBuffer<Transform> transforms : register(t3, space0);
+
+cbuffer UniformBlock : register(b0, space1) {
+    float2 screen_size : packoffset(c0);
+    uint quad_offset : packoffset(c0.z);
+    uint use_order : packoffset(c0.w);
+    float2 offset : packoffset(c1);
+    uint clip_base : packoffset(c1.z);
+    uint depth_offset : packoffset(c1.w);
+    uint quad_count : packoffset(c2.x);
+    uint reverse : packoffset(c2.y);
+    uint instanced : packoffset(c2.z);
+    uint transform_base : packoffset(c2.w);
+    uint culled : packoffset(c3.x);
+    uint source_first : packoffset(c3.y);
+};
+
+// Later quads are nearer. Depth is exact for the first 2^23 quads of a
+// frame; past that neighbours may share a depth, which only matters for
+// opaque quads drawn over each other.
+static const float DEPTH_STEP = 1.0 / 16777216.0;
+
+static const float PI = 3.14159265;
+
+static const uint tri_idx[6] = {0, 1, 2, 2, 3, 0};
+
+float4 unpack_color(uint c) {
+    return float4(c & 0xff, (c >> 8) & 0xff, (c >> 16) & 0xff, c >> 24) / 255.0;
+}
+
+float4 unpack_unorm16x4(uint2 v) {
+    return float4(v.x & 0xffff, v.x >> 16, v.y & 0xffff, v.y >> 16) / 65535.0;
+}
+
+float4 unpack_half4(uint2 v) {
+    return float4(f16tof32(v.x), f16tof32(v.x >> 16), f16tof32(v.y), f16tof32(v.y >> 16));
+}
+
+Varyings main(uint id : SV_VertexID, uint instance : SV_InstanceID) {
+
+    // Instanced draws run an instance per quad over a shared indexed quad,
+    // whose vertex ID is the corner. Otherwise six vertices expand each quad.
+    uint quad = instanced ? instance : id / 6;
+    uint corner = instanced ? id : tri_idx[id % 6];
+
+    // The opaque pass draws front to back, so it walks each range backwards
+    if (reverse) {
+        quad = quad_count - 1 - quad;
+    }
+
+    // When layers reorder the frame, draws index into a sorted list of quads
+    uint index = quad_offset + quad;
+    if (use_order) {
+        index = order[index];
+    }
+    VertexData d = data[index];
+
+    // GPU culled draws list their visible quads, backwards in the opaque
+    // pass, so their depth goes by where the quad is in its batch
+    uint depth_index = culled ? index - source_first : quad;
+    float4 src_rect = unpack_unorm16x4(d.src_rect);
+
+    float2 vert_pos[4] = {
+        float2(d.dst_rect.x, d.dst_rect.y),
+        float2(d.dst_rect.x, d.dst_rect.y + d.dst_rect.w),
+        float2(d.dst_rect.x + d.dst_rect.z, d.dst_rect.y + d.dst_rect.w),
+        float2(d.dst_rect.x + d.dst_rect.z, d.dst_rect.y),
+    };
+
+    float2 tex_coords[4] = {
+        float2(src_rect.x, src_rect.y),
+        float2(src_rect.x, src_rect.y + src_rect.w),
+        float2(src_rect.x + src_rect.z, src_rect.y + src_rect.w),
+        float2(src_rect.x + src_rect.z, src_rect.y),
+    };
+
+    // Clip by moving the corners onto the clip rect and shifting the texture
+    // coordinates to match. local is measured from the unclipped center, so
+    // the fragment SDF is unaffected, and fully clipped quads collapse to
+    // nothing. Quads that are only moved or scaled stay axis aligned and
+    // clip the same way on screen; rotated or sheared ones can't, and are
+    // clipped by distance to the clip rect's edges instead.
+    // Static batches are recorded without clips and take the one they are
+    // drawn under. Their transform indices are relative like their clips',
+    // and their offset moves them after the transform.
+    float4 clip = clips[clip_base + (d.flags >> QUAD_CLIP_SHIFT)];
+    float2 clip_min = clip.xy;
+    float2 clip_max = max(clip.xy, clip.xy + clip.zw);
+    Transform t = transforms[transform_base + (d.border_transform >> 16)];
+    float2 pos = vert_pos[corner];
+    float2 clipped = pos;
+    float2 screen_pos;
+    float4 clip_distance = 1;
+    if (t.m.y == 0 && t.m.z == 0 && t.m.x != 0 && t.m.w != 0) {
+        float2 moved = pos * t.m.xw + t.t + offset;
+        screen_pos = clamp(moved, clip_min, clip_max);
+        clipped = pos + (screen_pos - moved) / t.m.xw;
+    } else {
+        screen_pos = t.m.xy * pos.x + t.m.zw * pos.y + t.t + offset;
+        clip_distance = float4(screen_pos - clip_min, clip_max - screen_pos);
+    }
+    float2 tex_coord = tex_coords[corner];
+    if (d.dst_rect.z > 0 && d.dst_rect.w > 0) {
+        tex_coord += (clipped - pos) / d.dst_rect.zw * src_rect.zw;
+    }
+
+    float4 radii = unpack_half4(d.corner_radii);
+    float border = f16tof32(d.border_transform);
+    float2 half_size = d.dst_rect.zw / 2;
+
+    Varyings output;
+    output.tex_coord = tex_coord;
+    output.color = unpack_color(d.color);
+    float depth = 1.0 - (depth_offset + depth_index + 1) * DEPTH_STEP;
+    output.position = float4((screen_pos / (screen_size / 2) - 1) * float2(1, -1), depth, 1);
+    output.clip_distance = clip_distance;
+    output.local = clipped - (d.dst_rect.xy + half_size);
+    output.half_sizes = float4(half_size, half_size - (border + 1));
+    output.corner_radii = radii;
+    output.inner_radii = radii - (border + 2);
+    // Edges are measured in the quad's own units, which scaling stretches
+    float scale = sqrt(max(abs(t.m.x * t.m.w - t.m.z * t.m.y), 1e-6));
+    output.aa = float2(0.0015, 0.0025) * screen_size.y / scale;
+    output.border_color = unpack_color(d.border_color);
+    output.flags = d.flags;
+
+    // Lines and arcs keep their shape in fields boxes use for other things,
+    // see draw_segment and draw_arc
+    uint prim = d.flags & QUAD_PRIM_MASK;
+    float2 center = d.dst_rect.xy + half_size;
+    output.shape = 0;
+    if (prim == QUAD_PRIM_LINE) {
+        float2 a = d.dst_rect.xy + src_rect.xy * d.dst_rect.zw;
+        float2 b = d.dst_rect.xy + src_rect.zw * d.dst_rect.zw;
+        output.shape = float4(a - center, b - center);
+        output.half_sizes.x = border / 2;
+    } else if (prim == QUAD_PRIM_ARC) {
+        // A sweep of 2 pi doesn't survive being a half exactly
+        float mid = radii.x + radii.y / 2;
+        float aperture = radii.y >= 6.28 ? PI : radii.y / 2;
+        output.shape = float4(cos(mid), sin(mid), sin(aperture), cos(aperture));
+        float radius = half_size.x - 1;
+        output.half_sizes.xy = border > 0 ? float2(radius - border / 2, border / 2) : float2(radius, 0);
+    }
+    return output;
+}
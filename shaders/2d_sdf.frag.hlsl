@@ -0,0 +1,6 @@
+#include "2d_common.hlsli"
+
+// Rounded and bordered rects
+float4 main(Varyings input) : SV_Target0 {
+    return finish(input, shade_sdf(input));
+}
@@ -0,0 +1,5 @@
+#include "2d_common.hlsli"
+
+float4 main(Varyings input) : SV_Target0 {
+    return finish(input, input.color);
+}
@@ -0,0 +1,6 @@
+#include "2d_common.hlsli"
+#include "2d_textures.hlsli"
+
+float4 main(Varyings input) : SV_Target0 {
+    return finish(input, input.color * sample_quad(input));
+}
@@ -0,0 +1,36 @@
+// One binding per slot; keep in sync with MAX_TEXTURE_SLOTS in platform_sdl3.c
+Texture2D<float4> texture0 : register(t0, space2);
+SamplerState sampler0 : register(s0, space2);
+Texture2D<float4> texture1 : register(t1, space2);
+SamplerState sampler1 : register(s1, space2);
+Texture2D<float4> texture2 : register(t2, space2);
+SamplerState sampler2 : register(s2, space2);
+Texture2D<float4> texture3 : register(t3, space2);
+SamplerState sampler3 : register(s3, space2);
+Texture2D<float4> texture4 : register(t4, space2);
+SamplerState sampler4 : register(s4, space2);
+Texture2D<float4> texture5 : register(t5, space2);
+SamplerState sampler5 : register(s5, space2);
+Texture2D<float4> texture6 : register(t6, space2);
+SamplerState sampler6 : register(s6, space2);
+Texture2D<float4> texture7 : register(t7, space2);
+SamplerState sampler7 : register(s7, space2);
+
+// The slot varies per quad, so use SampleLevel to stay clear of implicit
+// derivatives in divergent control flow. Textures have a single mip anyway.
+float4 sample_slot(uint slot, float2 uv) {
+    switch (slot) {
+        case 0: return texture0.SampleLevel(sampler0, uv, 0);
+        case 1: return texture1.SampleLevel(sampler1, uv, 0);
+        case 2: return texture2.SampleLevel(sampler2, uv, 0);
+        case 3: return texture3.SampleLevel(sampler3, uv, 0);
+        case 4: return texture4.SampleLevel(sampler4, uv, 0);
+        case 5: return texture5.SampleLevel(sampler5, uv, 0);
+        case 6: return texture6.SampleLevel(sampler6, uv, 0);
+        default: return texture7.SampleLevel(sampler7, uv, 0);
+    }
+}
+
+float4 sample_quad(Varyings input) {
+    return sample_slot((input.flags >> QUAD_SLOT_SHIFT) & 0xf, input.tex_coord);
+}
@@ -0,0 +1,11 @@
+#include "2d_common.hlsli"
+#include "2d_textures.hlsli"
+
+// Handles every kind of quad. Only used when specialized pipelines are
+// turned off, to compare against them.
+float4 main(Varyings input) : SV_Target0 {
+    if (input.flags & QUAD_TEXTURED) {
+        return finish(input, input.color * sample_quad(input));
+    }
+    return finish(input, shade_sdf(input));
+}
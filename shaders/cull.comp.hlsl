@@ -0,0 +1,108 @@
+#include "2d_common.hlsli"
+
+// Culls one draw's quads against their clips and lists the visible ones, in
+// order, for an indirect draw. It runs in three stages, each in a pass of
+// its own so it sees what the last wrote:
+//   0: each group counts its visible quads
+//   1: a single group turns the counts into offsets and fills the draw args
+//   2: each group writes its visible quads' indices from its offset, or from
+//      the end for draws in the opaque pass, which go front to back
+// Only plain group shared memory is used, no wave intrinsics, so software
+// drivers like lavapipe should be able to run it.
+
+StructuredBuffer<VertexData> quads : register(t0, space0);
+StructuredBuffer<float4> clips : register(t1, space0);
+StructuredBuffer<Transform> transforms : register(t2, space0);
+
+RWStructuredBuffer<uint> groups : register(u0, space1);
+RWStructuredBuffer<uint> visible : register(u1, space1);
+RWStructuredBuffer<uint> args : register(u2, space1);  // SDL_GPUIndirectDrawCommand
+
+cbuffer CullUniforms : register(b0, space2) {
+    float2 offset : packoffset(c0);
+    uint quad_first : packoffset(c0.z);
+    uint quad_count : packoffset(c0.w);
+    uint group_first : packoffset(c1.x);
+    uint visible_first : packoffset(c1.y);
+    uint args_first : packoffset(c1.z);
+    uint clip_base : packoffset(c1.w);
+    uint stage : packoffset(c2.x);
+    uint transform_base : packoffset(c2.y);
+    uint reverse : packoffset(c2.z);
+};
+
+// Keep in sync with CULL_GROUP_SIZE in platform_sdl3.c
+#define GROUP_SIZE 256
+
+groupshared uint scan[GROUP_SIZE];
+
+bool is_visible(uint i) {
+    if (i >= quad_count) {
+        return false;
+    }
+    VertexData d = quads[quad_first + i];
+    float4 clip = clips[clip_base + (d.flags >> QUAD_CLIP_SHIFT)];
+
+    // Bounds of the quad on screen, placed like 2d_quad.vert.hlsl does
+    Transform t = transforms[transform_base + (d.border_transform >> 16)];
+    float2 center = t.m.xy * (d.dst_rect.x + d.dst_rect.z / 2) + t.m.zw * (d.dst_rect.y + d.dst_rect.w / 2) + t.t + offset;
+    float2 extent = (abs(t.m.xy) * d.dst_rect.z + abs(t.m.zw) * d.dst_rect.w) / 2;
+    float2 lo = center - extent;
+    float2 hi = center + extent;
+    return lo.x < clip.x + clip.z && hi.x > clip.x && lo.y < clip.y + clip.w && hi.y > clip.y;
+}
+
+// Inclusive prefix sum across the group
+uint group_scan(uint tid, uint value) {
+    scan[tid] = value;
+    GroupMemoryBarrierWithGroupSync();
+    for (uint step = 1; step < GROUP_SIZE; step *= 2) {
+        uint add = tid >= step ? scan[tid - step] : 0;
+        GroupMemoryBarrierWithGroupSync();
+        scan[tid] += add;
+        GroupMemoryBarrierWithGroupSync();
+    }
+    return scan[tid];
+}
+
+[numthreads(GROUP_SIZE, 1, 1)]
+void main(uint3 group : SV_GroupID, uint3 thread : SV_GroupThreadID) {
+    uint tid = thread.x;
+
+    if (stage == 1) {
+        uint group_count = (quad_count + GROUP_SIZE - 1) / GROUP_SIZE;
+        uint base = 0;
+        for (uint first = 0; first < group_count; first += GROUP_SIZE) {
+            uint g = first + tid;
+            uint count = g < group_count ? groups[group_first + g] : 0;
+            uint sum = group_scan(tid, count);
+            if (g < group_count) {
+                groups[group_first + g] = base + sum - count;
+            }
+            base += scan[GROUP_SIZE - 1];
+            GroupMemoryBarrierWithGroupSync();
+        }
+        if (tid == 0) {
+            args[args_first + 0] = base * 6;
+            args[args_first + 1] = 1;
+            args[args_first + 2] = 0;
+            args[args_first + 3] = 0;
+        }
+        return;
+    }
+
+    uint i = group.x * GROUP_SIZE + tid;
+    uint v = is_visible(i) ? 1 : 0;
+    uint sum = group_scan(tid, v);
+    if (stage == 0) {
+        if (tid == GROUP_SIZE - 1) {
+            groups[group_first + group.x] = sum;
+        }
+    } else if (v) {
+        uint slot = groups[group_first + group.x] + sum - 1;
+        if (reverse) {
+            slot = args[args_first] / 6 - 1 - slot;
+        }
+        visible[visible_first + slot] = quad_first + i;
+    }
+}
@@ -0,0 +1,287 @@
+#include "platform.h"
+#include "platform_sdl3.c"
+#include "sound_sdl3.c"
+
+// Renderer benchmarks, run from the repo root like main2.
+//
+// Fill rate: full-screen layers of every quad kind drawn over each other,
+// so the frame is bound by fragment shading. Every fourth layer is opaque.
+//   S          toggle specialized pipelines
+//   D          toggle the depth-tested opaque pass
+//   F          toggle dynamic resolution holding 16 ms per frame
+//   Up, Down   more or fewer layers
+//   L          toggle a 100k segment line chart over the layers
+//   T          toggle building the layers on worker threads with draw lists
+//   B          cycle the blend mode the layers are drawn with when they
+//              aren't built on worker threads
+//
+// Retained scene: a static batch of a million rects covering about 100
+// screens, panned around, in place of the layers.
+//   R          toggle the retained scene
+//   G          toggle GPU culling
+//   V          toggle checking the GPU cull against a CPU cull of the same
+//              draws, which reads them back every frame
+//   C          toggle moving the scene with a zooming camera instead of the
+//              batch offset
+//
+// Stress: a million or ten million 1x1 quads written with draw_reserve_quads
+// every frame, in place of the layers. Quad memory grows by chunks and
+// shrinks back after.
+//   X          cycle the stress frame off, 1M quads, 10M quads
+//   I          toggle instanced quads
+//
+//   Q          quit
+
+#define CHART_POINTS 100001
+#define SCENE_SIDE 1000
+
+#define BENCH_THREADS 4
+
+static void draw_layers(int first, int last, f32 w, f32 h, f32 t, Texture *texture, Font *font) {
+    for (int i = first; i < last; i++) {
+        // Everything moves a little every frame so none is skipped or
+        // partially redrawn
+        f32 phase = t + i * 0.37f;
+        f32 dx = 8.0f * SDL_sinf(phase);
+        f32 dy = 8.0f * SDL_cosf(phase);
+        Color color = {0.5f + 0.5f * SDL_sinf(phase), 0.5f, 0.5f + 0.5f * SDL_cosf(phase), 0.1f};
+
+        switch (i % 4) {
+            case 0:
+                draw_rect((Rect){dx, dy, w, h}, (Color){color.r, color.g, color.b, 1.0f});
+                break;
+            case 1:
+                draw_rounded_border_rect((Rect){dx, dy, w, h}, 64.0f, 8.0f, color, (Color){1.0f, 1.0f, 1.0f, 0.2f});
+                break;
+            case 2:
+                draw_texture(texture, (Rect){0.0f, 0.0f, (f32)texture->w, (f32)texture->h}, (Rect){dx, dy, w, h});
+                break;
+            case 3:
+                for (f32 y = dy - font->scale; y < h; y += font->scale) {
+                    draw_text(font, "MWMWMWMWMWMWMWMWMWMW", dx, y, color);
+                }
+                break;
+        }
+    }
+}
+
+typedef struct LayerWorker {
+    DrawList *list;
+    int first;
+    int last;
+    f32 w;
+    f32 h;
+    f32 t;
+    Texture *texture;
+    Font *font;
+} LayerWorker;
+
+static int layer_worker(void *data) {
+    LayerWorker *worker = data;
+    begin_draw_list(worker->list, (Rect){0.0f, 0.0f, worker->w, worker->h});
+    draw_layers(worker->first, worker->last, worker->w, worker->h, worker->t, worker->texture, worker->font);
+    end_draw_list();
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    // Don't let vsync hide the GPU time
+    app_configure((AppConfig){.title = "Bench", .w = 1280, .h = 720, .no_vsync = true});
+    app_init();
+
+    Font font = load_font("res/fonts/vera/Vera.ttf", 100);
+    Texture texture = load_texture("res/bird.png");
+
+    bool specialized = true;
+    bool opaque_pass = true;
+    bool dynamic_resolution = false;
+    int layers = 16;
+    bool chart = false;
+    bool threaded = false;
+    BlendMode blend = BLEND_ALPHA;
+    char *blend_names[] = {"alpha", "premultiplied", "additive", "multiply"};
+    LayerWorker workers[BENCH_THREADS];
+    for (int k = 0; k < BENCH_THREADS; k++) {
+        workers[k].list = create_draw_list();
+    }
+    bool retained = false;
+    bool gpu_culling = false;
+    bool cull_check = false;
+    bool camera = false;
+    bool instanced = true;
+    int stress = 0; // quads
+    StaticBatch *scene = NULL;
+    Vec2 *chart_points = malloc(CHART_POINTS * sizeof(Vec2));
+    int frames = 0;
+    u64 frame_number = 0;
+    f64 frame_ms = 0.0;
+    u64 last_report = SDL_GetTicks();
+    u64 last_frame = SDL_GetPerformanceCounter();
+
+    while (!app_should_quit()) {
+        u64 now = SDL_GetPerformanceCounter();
+        frame_ms += (f64)(now - last_frame) * 1000.0 / (f64)SDL_GetPerformanceFrequency();
+        last_frame = now;
+        frames++;
+        frame_number++;
+
+        if (SDL_GetTicks() - last_report >= 1000) {
+            RenderStats stats = get_render_stats();
+            printf("%s%s%s%s%s layers=%d blend=%s %.2f ms/frame quads=%d upload=%.1f KB draws=%d pipeline switches=%d pipelines=%d chunks=%d gpu culled=%d%s overdraw=%.1f blended=%.1f scale=%.2f\n",
+                specialized ? "specialized" : "uber", opaque_pass ? "+depth" : "", retained ? (camera ? " retained+camera" : " retained") : "", threaded ? " threaded" : "",
+                instanced ? " instanced" : "",
+                layers, blend_names[blend], frame_ms / frames, stats.quads, stats.upload_bytes / 1024.0, stats.draw_calls, stats.pipeline_switches, stats.pipelines,
+                stats.quad_chunks, stats.gpu_culled_draws, cull_check ? (stats.gpu_cull_mismatches ? " MISMATCHED" : " checked") : "", stats.overdraw, stats.blended_overdraw, stats.render_scale);
+            frames = 0;
+            frame_ms = 0.0;
+            last_report = SDL_GetTicks();
+        }
+
+        if (is_key_pressed(KEY_S)) {
+            specialized = !specialized;
+            set_specialized_pipelines(specialized);
+        }
+        if (is_key_pressed(KEY_D)) {
+            opaque_pass = !opaque_pass;
+            set_opaque_pass(opaque_pass);
+        }
+        if (is_key_pressed(KEY_F)) {
+            dynamic_resolution = !dynamic_resolution;
+            set_frame_time_target(dynamic_resolution ? 16.0f : 0.0f);
+            set_render_scale(1.0f);
+        }
+        if (is_key_pressed(KEY_UP)) {
+            layers *= 2;
+        }
+        if (is_key_pressed(KEY_DOWN) && layers > 1) {
+            layers /= 2;
+        }
+        if (is_key_pressed(KEY_R)) {
+            retained = !retained;
+        }
+        if (is_key_pressed(KEY_G)) {
+            gpu_culling = !gpu_culling;
+            set_gpu_culling(gpu_culling);
+        }
+        if (is_key_pressed(KEY_V)) {
+            cull_check = !cull_check;
+            set_gpu_cull_check(cull_check);
+        }
+        if (is_key_pressed(KEY_C)) {
+            camera = !camera;
+        }
+        if (is_key_pressed(KEY_T)) {
+            threaded = !threaded;
+        }
+        if (is_key_pressed(KEY_B)) {
+            blend = (blend + 1) % 4;
+        }
+        if (is_key_pressed(KEY_L)) {
+            chart = !chart;
+        }
+        if (is_key_pressed(KEY_X)) {
+            stress = stress == 0 ? 1000000 : stress == 1000000 ? 10000000 : 0;
+        }
+        if (is_key_pressed(KEY_I)) {
+            instanced = !instanced;
+            set_instanced_quads(instanced);
+        }
+        if (is_key_pressed(KEY_Q)) {
+            app_quit();
+        }
+
+        Vec2 screen_size = get_screen_size();
+        f32 w = screen_size.x;
+        f32 h = screen_size.y;
+        f32 t = frame_number / 60.0f;
+
+        app_clear((Color){0.0f, 0.0f, 0.0f, 1.0f});
+        if (stress) {
+            // A chunk at a time, the most one reservation can hold
+            int columns = (int)w;
+            for (int first = 0; first < stress; first += QUAD_CHUNK_SIZE) {
+                int count = SDL_min(stress - first, QUAD_CHUNK_SIZE);
+                u32 flags;
+                GpuQuad *quads = draw_reserve_quads(NULL, (Rect){0.0f, 0.0f, w, h}, count, &flags);
+                u32 color = pack_color((Color){0.5f + 0.5f * SDL_sinf(t + first), 0.5f, 0.5f, 0.05f});
+                for (int i = 0; i < count; i++) {
+                    int n = first + i;
+                    quads[i] = (GpuQuad){
+                        .dst_rect = {(f32)(n % columns), (f32)(n / columns % (int)h), 1.0f, 1.0f},
+                        .color = color,
+                        .border_color = color,
+                        .flags = flags,
+                    };
+                }
+            }
+        } else if (retained) {
+            if (!scene) {
+                scene = begin_static_batch();
+                for (int y = 0; y < SCENE_SIDE; y++) {
+                    for (int x = 0; x < SCENE_SIDE; x++) {
+                        Color color = {(f32)x / SCENE_SIDE, (f32)y / SCENE_SIDE, 0.5f, 0.8f};
+                        draw_rect((Rect){x * 12.0f, y * 12.0f, 10.0f, 10.0f}, color);
+                    }
+                }
+                end_static_batch();
+            }
+            // Pan in a circle over the middle of the scene
+            f32 center = SCENE_SIDE * 6.0f;
+            Vec2 offset = {
+                .x = w / 2 - center + 0.4f * center * SDL_cosf(t * 0.2f),
+                .y = h / 2 - center + 0.4f * center * SDL_sinf(t * 0.2f),
+            };
+            if (camera) {
+                Vec2 look_at = {.x = w / 2 - offset.x, .y = h / 2 - offset.y};
+                set_camera(look_at, 1.0f + 0.5f * SDL_sinf(t * 0.5f), 0.0f);
+                draw_static_batch(scene, (Vec2){0});
+                reset_camera();
+            } else {
+                draw_static_batch(scene, offset);
+            }
+        }
+        bool layered = !retained && stress == 0;
+        if (threaded && layered) {
+            // Each worker draws a consecutive range of layers, so submitting
+            // the lists in order keeps the painter's order
+            SDL_Thread *threads[BENCH_THREADS];
+            for (int k = 0; k < BENCH_THREADS; k++) {
+                workers[k] = (LayerWorker){
+                    .list = workers[k].list,
+                    .first = layers * k / BENCH_THREADS,
+                    .last = layers * (k + 1) / BENCH_THREADS,
+                    .w = w,
+                    .h = h,
+                    .t = t,
+                    .texture = &texture,
+                    .font = &font,
+                };
+                threads[k] = SDL_CreateThread(layer_worker, "layers", &workers[k]);
+            }
+            for (int k = 0; k < BENCH_THREADS; k++) {
+                SDL_WaitThread(threads[k], NULL);
+                submit_draw_list(workers[k].list);
+            }
+        } else if (layered) {
+            push_blend_mode(blend);
+            draw_layers(0, layers, w, h, t, &texture, &font);
+            pop_blend_mode();
+        }
+
+        if (chart) {
+            for (int i = 0; i < CHART_POINTS; i++) {
+                f32 x = (f32)i / (CHART_POINTS - 1);
+                chart_points[i] = (Vec2){
+                    .x = x * w,
+                    .y = h * (0.5f + 0.3f * SDL_sinf(x * 40.0f + t) + 0.1f * SDL_sinf(x * 2000.0f - t * 3.0f)),
+                };
+            }
+            draw_polyline(chart_points, CHART_POINTS, 1.5f, (Color){1.0f, 1.0f, 0.2f, 1.0f});
+            draw_circle((Vec2){.x = w - 40.0f, .y = 40.0f}, 24.0f, (Color){1.0f, 0.3f, 0.3f, 1.0f});
+            draw_arc((Vec2){.x = w - 40.0f, .y = 40.0f}, 30.0f, 4.0f, t, 4.0f, (Color){1.0f, 1.0f, 1.0f, 1.0f});
+        }
+    }
+
+    return 0;
+}
@@ -54,7 +54,22 @@ int main(int argc, char **argv) {
             (Color){1.0f, 1.0f, 0.0f, 1.0f}
         );
 
+        f32 angle = SDL_GetTicks() / 1000.0f;
+        draw_rounded_rect_transformed(
+            (Rect){500.0f, 200.0f, 40.0f, 60.0f},
+            10.0f,
+            rotation_m2(angle),
+            (Vec2){.x = 520.0f, .y = 230.0f},
+            (Color){1.0f, 0.0f, 1.0f, 1.0f}
+        );
 
+        draw_texture_transformed(
+            &texture,
+            (Rect){0.0f, 0.0f, (f32)texture.w, (f32)texture.h},
+            (Rect){600.0f, 200.0f, 64.0f, 64.0f},
+            rotation_m2(-angle),
+            (Vec2){.x = 632.0f, .y = 232.0f}
+        );
 
         draw_text(&font, "Hello", 0, 0, (Color){0.0f, 0.5f, 0.0f, 1.0f});
 
@@ -7,6 +7,7 @@
 typedef struct AppConfig {
     char *title;
     int w, h;
+    bool no_vsync; // present as soon as a frame is done, where supported
 } AppConfig;
 
 typedef struct Rect {
@@ -19,6 +20,7 @@ typedef struct Texture {
     void *handle; // SDL_GPUTexture*
     int w, h, d;
     int idx;
+    bool opaque; // every pixel has full alpha
 } Texture;
 
 typedef struct Font {
@@ -29,6 +31,64 @@ typedef struct Font {
 
 typedef struct Sound Sound;
 
+// Keep in sync with 2d_common.hlsli
+#define QUAD_TEXTURED (1 << 0)
+#define QUAD_BORDER (1 << 1)
+#define QUAD_PRIM_MASK (3 << 2) // shape evaluated by the SDF shader, a box when 0
+#define QUAD_PRIM_LINE (1 << 2)
+#define QUAD_PRIM_ARC (2 << 2)
+#define QUAD_CAP_SHIFT 4 // LineCap of QUAD_PRIM_LINE
+#define QUAD_PREMULTIPLY (1 << 6) // shade with color premultiplied by alpha, set for BLEND_MULTIPLY
+#define QUAD_SLOT_SHIFT 8
+#define QUAD_CLIP_SHIFT 16
+
+// Per-quad instance data read by 2d_quad.vert.hlsl. Colors are RGBA8, texture
+// coordinates unorm16 and sizes half floats, which keeps it at 48 bytes.
+// Lines keep their endpoints in src_rect, relative to dst_rect, and their
+// thickness in border_thickness. Arcs keep their start angle and sweep in
+// corner_radii[0..1] and their thickness in border_thickness. transform is
+// an index from quad_transform, 0 for none.
+typedef struct GpuQuad {
+    Rect dst_rect;
+    u16 src_rect[4];
+    u16 corner_radii[4];
+    u32 color;
+    u32 border_color;
+    u16 border_thickness;
+    u16 transform;
+    u32 flags;
+} GpuQuad;
+
+// Renderer counters for the last presented frame
+typedef struct RenderStats {
+    int quads;
+    int draw_calls;
+    int render_passes;
+    int merged_batches; // earlier batches that later quads joined instead of opening a new one
+    int culled_quads; // quads dropped for being outside the window or clip
+    bool skipped; // nothing changed since the last frame, so it wasn't drawn
+    Rect damage; // region that was redrawn
+    u64 upload_bytes;
+    int opaque_quads; // quads drawn front to back in the depth-tested opaque pass
+    f32 overdraw; // quad area per screen pixel, what painter's order would shade
+    f32 blended_overdraw; // the part of overdraw left to the blended pass; the
+                          // opaque pass shades each pixel about once at most
+    f32 render_scale;
+    int gpu_culled_draws; // draws culled by the compute pass; quads counts
+                          // their quads whether they turned out visible or not
+    int quad_chunks; // QUAD_CHUNK_SIZE pieces of upload memory the frame's slot holds
+    int gpu_cull_mismatches; // culled draws the GPU cull check disagreed with, see set_gpu_cull_check
+    int pipeline_switches; // graphics pipeline binds; draws with the same state share one
+    int pipelines; // pipelines created so far, one per shader and blend state drawn with
+} RenderStats;
+
+typedef enum BlendMode {
+    BLEND_ALPHA, // colors are straight, drawn over what is under them
+    BLEND_PREMULTIPLIED, // colors are already multiplied by their alpha
+    BLEND_ADDITIVE, // adds color times alpha, for glows and particles
+    BLEND_MULTIPLY, // darkens by color, fading to no change where alpha is 0
+} BlendMode;
+
 typedef enum Key {
     KEY_INVALID          = 0,
     KEY_SPACE            = 32,
@@ -165,20 +225,194 @@ typedef enum Button {
     BUTTON_COUNT,
 } Button;
 
+// app_configure is optional and goes before app_init
+void app_configure(AppConfig config);
 void app_init();
 bool app_should_quit();
 void app_quit();
 
 void app_clear(Color color);
+RenderStats get_render_stats();
+Vec2 get_screen_size();
+
+// In idle mode app_should_quit blocks until input arrives or a redraw is
+// requested, instead of running every frame. Animations keep the loop going
+// by calling request_redraw each frame. request_redraw can be called from
+// any thread.
+void set_idle_mode(bool enabled);
+void request_redraw();
+void request_redraw_after(u32 ms);
+
+// Quads are drawn with a pipeline specialized for their kind (solid, rounded
+// or bordered, sprite, glyph). Turning this off draws everything with one
+// general shader, which only makes sense for benchmarking.
+void set_specialized_pipelines(bool enabled);
+
+// Opaque quads (full alpha solid rects and sprites with opaque textures) are
+// drawn first, front to back with depth testing, so the GPU skips pixels
+// that something nearer covers. Turning it off is for benchmarking.
+void set_opaque_pass(bool enabled);
+
+// Quads are drawn as instances of one indexed quad, so the vertex shader runs
+// four times per quad instead of six. Turning it off expands every quad from
+// six vertices, which is for benchmarking.
+void set_instanced_quads(bool enabled);
+
+// Static batch draws of thousands of quads are culled against their clip by
+// a compute pass and drawn indirectly, so panning a huge retained scene
+// costs the CPU nothing per quad. Off by default.
+void set_gpu_culling(bool enabled);
+
+// Checks the GPU cull: each culled draw's quads and indirect args are read
+// back and its visible count compared with the same cull on the CPU, when the
+// frame's slot is next waited on. Mismatches are logged and counted in
+// RenderStats. Reading back is slow; this is for testing cull.comp.hlsl, on
+// a software driver like lavapipe if need be.
+void set_gpu_cull_check(bool enabled);
+
+// Frames are rendered at scale times the window's resolution, from 0.25 to 1,
+// and stretched to fit, trading sharpness for fill rate. With a frame time
+// target the scale adjusts itself to hold it; 0 turns that off and keeps the
+// scale where it is.
+void set_render_scale(f32 scale);
+void set_frame_time_target(f32 ms);
 
 Texture load_texture(char *filename);
 Font load_font(const char* filename, float size);
 
 
+// Quads are drawn in layer order, lowest first, and in call order within a
+// layer. Layers range from 0 (the default) to 255.
+void push_layer(int layer);
+void pop_layer();
+
+// Sets how everything drawn until the matching pop is blended with what is
+// under it. Quads only share a batch with quads of the same blend mode, so
+// switching back and forth costs a draw each time. Static batches keep the
+// blend mode they were recorded with; draw lists are always BLEND_ALPHA.
+// Cached layers are composited premultiplied whatever the mode.
+void push_blend_mode(BlendMode blend);
+void pop_blend_mode();
+
+// Clips everything drawn until the matching pop. Nested clips intersect.
+// Clipping happens in the vertex shader, so it doesn't split batches. Under
+// a rotating transform the clip is the bounds of the transformed rect.
+void push_clip_rect(Rect rect);
+void pop_clip_rect();
+
+// Everything drawn is mapped through the camera, then through the transforms
+// pushed since, innermost first. push_transform maps p to
+// m (p - pivot) + pivot + offset. Transforms are applied by the vertex
+// shader from a small per-frame table, so moving the camera over a static
+// batch uploads a few bytes instead of its quads. The camera puts center in
+// the middle of the window, zoomed and turned clockwise by rotation, and
+// stays until it is set again. Static batches, cached layer content and draw
+// lists are recorded untransformed and take the transform they are drawn
+// under.
+void push_transform(Mat2 m, Vec2 pivot, Vec2 offset);
+void pop_transform();
+void set_camera(Vec2 center, f32 zoom, f32 rotation);
+void reset_camera();
+Vec2 screen_to_world(Vec2 point);
+
+// Static batches keep their quads in GPU memory. Everything drawn between
+// begin_static_batch and end_static_batch is recorded instead of drawn,
+// uploaded once at the end, and can then be drawn every frame for the cost of
+// a draw per texture table. Clips pushed while recording are ignored; the
+// batch is clipped by whatever clip is active when it's drawn. A batch can be
+// freed at any time, including after drawing it in the frame being built.
+typedef struct StaticBatch StaticBatch;
+StaticBatch *begin_static_batch();
+void end_static_batch();
+void draw_static_batch(StaticBatch *batch, Vec2 offset);
+void free_static_batch(StaticBatch *batch);
+
+// Draw lists let other threads draw. Everything a thread draws between
+// begin_draw_list and end_draw_list is recorded into the list, culled to
+// cull_rect, without touching the frame. The main thread then adds lists to
+// the frame with submit_draw_list, in the order it wants them drawn, at the
+// layer and clip active when submitting. Lists keep their memory and are
+// reset by begin_draw_list. Quads from the draw_* functions and
+// draw_reserve_quads are recorded; layers, clips, static batches and cached
+// layers are for the main thread only. Lists can't be submitted while a
+// static batch is being recorded; that is logged and the list is dropped.
+// Building a list reads none of the main thread's settings:
+// set_specialized_pipelines and set_opaque_pass apply when it is drawn.
+typedef struct DrawList DrawList;
+DrawList *create_draw_list();
+void begin_draw_list(DrawList *list, Rect cull_rect);
+void end_draw_list();
+void submit_draw_list(DrawList *list);
+void free_draw_list(DrawList *list);
+
+// Cached layers (not to be confused with push_layer's sort layers) keep a
+// part of the screen in a texture of their own. begin_layer returns true when
+// the content has to be drawn: the first time, after invalidate_layer, or
+// when rect changes size. Draw it, then call end_layer either way, which
+// composites the layer as one quad. Content is drawn in screen coordinates
+// and clipped to rect; clips pushed inside are ignored. Layers don't nest.
+// The layer's quad is composited under the current transform.
+bool begin_layer(u32 id, Rect rect);
+void end_layer();
+void invalidate_layer(u32 id);
+void free_layer(u32 id);
+
+// Frame quads live in chunks of this many, which is also the most that can be
+// reserved at once
+#define QUAD_CHUNK_SIZE 65536
+
+// Reserves count quads directly in the frame's GPU upload memory. The pointer
+// is write-only (reading mapped memory is slow) and is valid until the next
+// draw call. bounds must cover every quad written. flags receives the bits
+// that select texture and clip, to be OR'd into each quad's flags. Pass a
+// NULL texture for untextured quads. Unlike the draw_* functions it does no
+// culling. Frames that use it are always redrawn in full. count can be at most
+// QUAD_CHUNK_SIZE, except in static batches and draw lists; NULL is returned
+// otherwise. Under a camera or transform, bounds are in transformed space and
+// quads need a transform from quad_transform, which includes the current one.
+GpuQuad *draw_reserve_quads(Texture *texture, Rect bounds, int count, u32 *flags);
+u32 pack_color(Color color);
+u16 pack_half(f32 value);
+u16 pack_unorm16(f32 value);
+void pack_rect_unorm16(u16 out[4], Rect rect);
+
 void draw_rect(Rect rect, Color color);
 void draw_texture(Texture *texture, Rect src, Rect dst);
 void draw_text(Font *font, const char *text, float x, float y, Color color);
 
+// Turns clockwise for positive angles, like draw_arc's
+Mat2 rotation_m2(f32 radians);
+
+// Rects and sprites transformed by m around pivot, a point in screen
+// coordinates that stays in place. The vertex shader applies the transform,
+// so they batch with everything else, and rounded corners and edges are
+// still antialiased in the rect's own space.
+void draw_rounded_rect_transformed(Rect rect, f32 radius, Mat2 m, Vec2 pivot, Color color);
+void draw_texture_transformed(Texture *texture, Rect src, Rect dst, Mat2 m, Vec2 pivot);
+
+// Adds m around pivot, inside the current transform, to the transforms of
+// what is being drawn and returns its index, for the transform field of
+// quads from draw_reserve_quads. Their bounds have to cover the transformed
+// quads. quad_transform(M2D(1.0f), (Vec2){0}) is the current transform alone.
+// Once a frame has 65536 transforms, 0 is returned and quads are drawn
+// untransformed.
+u16 quad_transform(Mat2 m, Vec2 pivot);
+
+typedef enum LineCap {
+    LINE_CAP_BUTT,
+    LINE_CAP_ROUND,
+    LINE_CAP_SQUARE,
+} LineCap;
+
+// Lines and arcs are antialiased shapes evaluated per pixel, batched with
+// everything else. Angles are in radians, clockwise from the positive x axis.
+// Polylines join their segments with round caps, so translucent ones are
+// darker at the joints. A zero thickness fills the arc as a pie.
+void draw_segment(Vec2 a, Vec2 b, f32 thickness, LineCap cap, Color color);
+void draw_polyline(Vec2 *points, int count, f32 thickness, Color color);
+void draw_arc(Vec2 center, f32 radius, f32 thickness, f32 start, f32 sweep, Color color);
+void draw_circle(Vec2 center, f32 radius, Color color);
+
 Sound load_sound(char *filename);
 void play_sound(Sound *sound);
 void play_music(Sound *sound);
@@ -36,62 +36,561 @@
 #define ATLAS_WIDTH 512
 #define ATLAS_HEIGHT 512
 
-typedef struct GpuQuad {
-    Rect dst_rect;
-    Rect src_rect;
-    Color border_color;
-    Vec4 corner_radii;
-    Color colors[4];
-    float edge_softness;
-    float border_thickness;
-    float use_texture;
-    float _padding[1]; // std140 alignment
-} GpuQuad;
-
-typedef struct VertStore {
-    GpuQuad *data;
+// Must match the number of samplers declared in 2d_textures.hlsli
+#define MAX_TEXTURE_SLOTS 8
+
+// Define CHECK_QUAD_RUNS to check on every flush that unsorted runs can be
+// drawn as batch ranges. It walks all runs, so it's off even in debug builds.
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL _Thread_local
+#endif
+
+u32 pack_color(Color color) {
+    u32 r = (u32)(SDL_clamp(color.r, 0.0f, 1.0f) * 255.0f + 0.5f);
+    u32 g = (u32)(SDL_clamp(color.g, 0.0f, 1.0f) * 255.0f + 0.5f);
+    u32 b = (u32)(SDL_clamp(color.b, 0.0f, 1.0f) * 255.0f + 0.5f);
+    u32 a = (u32)(SDL_clamp(color.a, 0.0f, 1.0f) * 255.0f + 0.5f);
+    return r | (g << 8) | (b << 16) | (a << 24);
+}
+
+u16 pack_unorm16(f32 value) {
+    return (u16)(SDL_clamp(value, 0.0f, 1.0f) * 65535.0f + 0.5f);
+}
+
+// Round-to-nearest float to IEEE half conversion. Values too small for a half
+// flush to zero, values too large saturate to infinity.
+u16 pack_half(f32 value) {
+    union { f32 f; u32 u; } bits = { .f = value };
+    u32 sign = (bits.u >> 16) & 0x8000;
+    i32 exponent = (i32)((bits.u >> 23) & 0xff) - 127 + 15;
+    u32 mantissa = bits.u & 0x7fffff;
+
+    if (exponent <= 0) {
+        return (u16)sign;
+    }
+    if (exponent >= 31) {
+        return (u16)(sign | 0x7c00);
+    }
+    u32 half = sign | ((u32)exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000) {
+        half++;
+    }
+    return (u16)half;
+}
+
+void pack_rect_unorm16(u16 out[4], Rect rect) {
+    out[0] = pack_unorm16(rect.x);
+    out[1] = pack_unorm16(rect.y);
+    out[2] = pack_unorm16(rect.w);
+    out[3] = pack_unorm16(rect.h);
+}
+
+static bool rects_intersect(Rect a, Rect b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h && b.y < a.y + a.h;
+}
+
+static f32 rect_area(Rect r) {
+    return r.w * r.h;
+}
+
+static Rect rect_union(Rect a, Rect b) {
+    if (a.w <= 0.0f || a.h <= 0.0f) {
+        return b;
+    }
+    f32 x0 = SDL_min(a.x, b.x);
+    f32 y0 = SDL_min(a.y, b.y);
+    f32 x1 = SDL_max(a.x + a.w, b.x + b.w);
+    f32 y1 = SDL_max(a.y + a.h, b.y + b.h);
+    return (Rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+static Rect rect_intersection(Rect a, Rect b) {
+    f32 x0 = SDL_max(a.x, b.x);
+    f32 y0 = SDL_max(a.y, b.y);
+    f32 x1 = SDL_min(a.x + a.w, b.x + b.w);
+    f32 y1 = SDL_min(a.y + a.h, b.y + b.h);
+    return (Rect){x0, y0, SDL_max(0.0f, x1 - x0), SDL_max(0.0f, y1 - y0)};
+}
+
+// Each kind of quad gets a pipeline whose fragment shader does only what
+// that kind needs. The uber pipeline handles all of them and is only used
+// when specialized pipelines are turned off. Opaque kinds are drawn without
+// blending in the depth-writing opaque pass.
+typedef enum PipelineKind {
+    PIPELINE_UBER,
+    PIPELINE_SOLID,
+    PIPELINE_SDF,
+    PIPELINE_SPRITE,
+    PIPELINE_GLYPH,
+    PIPELINE_SOLID_OPAQUE,
+    PIPELINE_SPRITE_OPAQUE,
+    PIPELINE_COUNT,
+} PipelineKind;
+
+static bool pipeline_is_opaque(PipelineKind pipeline) {
+    return pipeline == PIPELINE_SOLID_OPAQUE || pipeline == PIPELINE_SPRITE_OPAQUE;
+}
+
+static bool pipeline_samples(PipelineKind pipeline) {
+    return pipeline == PIPELINE_UBER || pipeline == PIPELINE_SPRITE || pipeline == PIPELINE_GLYPH ||
+        pipeline == PIPELINE_SPRITE_OPAQUE;
+}
+
+static char *pipeline_fragment_shaders[PIPELINE_COUNT] = {
+    [PIPELINE_UBER] = "shaders/2d_uber.frag.spv",
+    [PIPELINE_SOLID] = "shaders/2d_solid.frag.spv",
+    [PIPELINE_SDF] = "shaders/2d_sdf.frag.spv",
+    [PIPELINE_SPRITE] = "shaders/2d_sprite.frag.spv",
+    [PIPELINE_GLYPH] = "shaders/2d_glyph.frag.spv",
+    [PIPELINE_SOLID_OPAQUE] = "shaders/2d_solid.frag.spv",
+    [PIPELINE_SPRITE_OPAQUE] = "shaders/2d_sprite.frag.spv",
+};
+
+#define HASH_SEED 0xcbf29ce484222325ull
+
+static u64 hash_words(u64 hash, const void *data, int size) {
+    const u32 *words = data;
+    for (int i = 0; i < size / 4; i++) {
+        hash = (hash ^ words[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// Everything a graphics pipeline is created from that varies. Pipelines are
+// created the first time a state is drawn with and cached by its hash.
+typedef struct PipelineState {
+    PipelineKind kind;
+    BlendMode blend;
+} PipelineState;
+
+typedef struct PipelineCacheEntry {
+    u64 hash;
+    PipelineState state;
+    SDL_GPUGraphicsPipeline *pipeline;
+} PipelineCacheEntry;
+
+typedef struct PipelineCache {
+    PipelineCacheEntry *data;
+    int size;
+    int capacity;
+} PipelineCache;
+
+// A contiguous range of the frame's quads drawn with one pipeline and one
+// set of sampler bindings. Each quad picks its texture with texture_slot.
+typedef struct Batch {
+    PipelineKind pipeline;
+    BlendMode blend;
+    Texture textures[MAX_TEXTURE_SLOTS];
+    int texture_count;
+    int first;
+    int count;
+    int first_run;
+    bool merged; // later quads joined it after other batches were opened
+
+    // Set for a static batch drawn this frame; first and count then index
+    // its buffer instead of the frame's quads
+    StaticBatch *source;
+    Vec2 offset;
+    u32 clip_base;
+    u32 transform_base;
+} Batch;
+
+typedef struct BatchStore {
+    Batch *data;
+    int size;
+    int capacity;
+} BatchStore;
+
+// A draw call in painter's order. depth is the position of its first quad
+// among everything drawn this frame, which is how far back it sits.
+typedef struct Draw {
+    Batch *batch;
+    int first;
+    int count;
+    u32 depth;
+    bool use_order;
+
+    // Set when the compute pass culls the draw. Its visible quads are then
+    // read through the visible list and its vertex count from indirect args.
+    bool gpu_culled;
+    u32 cull_group_first;
+    u32 visible_first;
+    u32 args_offset;
+} Draw;
+
+typedef struct DrawStore {
+    Draw *data;
     int size;
     int capacity;
-} VertStore;
+} DrawStore;
+
+// A quad's transform maps a point p of its rect to m p + t on screen. Keep in
+// sync with Transform in 2d_common.hlsli.
+typedef struct GpuTransform {
+    Mat2 m;
+    Vec2 t;
+    Vec2 _padding;
+} GpuTransform;
+
+// Entry 0 is the identity, which quads use by default
+typedef struct TransformStore {
+    GpuTransform *data;
+    int size;
+    int capacity;
+} TransformStore;
 
-VertStore make_vert_store() {
-    GpuQuad *data = malloc(1024 * sizeof(GpuQuad));
-    return (VertStore){
+#define MAX_TRANSFORMS 65536
+
+TransformStore make_transform_store() {
+    GpuTransform *data = malloc(64 * sizeof(GpuTransform));
+    data[0] = (GpuTransform){.m = M2D(1.0f)};
+    return (TransformStore){
         .data = data,
-        .size = 0,
-        .capacity = 1024,
+        .size = 1,
+        .capacity = 64,
     };
 }
 
-void vert_clear(VertStore *store) {
-    store->size = 0;
+BatchStore make_batch_store() {
+    Batch *data = malloc(64 * sizeof(Batch));
+    return (BatchStore){
+        .data = data,
+        .size = 0,
+        .capacity = 64,
+    };
 }
 
-void free_vert_store(VertStore *store) {
-    free(store->data);
-    store->data = NULL;
-    store->size = 0;
-    store->capacity = 0;
+struct StaticBatch {
+    u32 id;
+    SDL_GPUBuffer *buffer;
+    GpuQuad *quads; // only while recording
+    int quad_count;
+    int quad_capacity;
+    BatchStore batches;
+    TransformStore transforms; // added to the frame's when drawn
+    Rect bounds;
+    f32 area;
+    f32 opaque_area;
+    StaticBatch *next_freed;
+};
+
+// Scratch space for laying out text. The main thread's is in _APP and each
+// draw list has its own, so threads drawing text don't share one.
+typedef struct GlyphScratch {
+    Rect *dst;
+    Rect *src;
+    int capacity;
+} GlyphScratch;
+
+// Quads drawn on any thread for the main thread to add to a frame. They are
+// recorded like a static batch's, then copied into the frame on submit.
+struct DrawList {
+    StaticBatch content;
+    GlyphScratch glyphs;
+    Rect cull_rect;
+    int culled_quads;
+    u64 hash; // of everything drawn, standing in for it in the display list
+    bool untracked;
+};
+
+// Consecutive quads that share a sort key. The key is the layer in the top
+// 8 bits and the batch index below it, so sorting runs by key groups them by
+// layer and keeps call order within a layer.
+typedef struct QuadRun {
+    u32 key;
+    int first;
+    int count;
+    Rect bounds;
+} QuadRun;
+
+typedef struct RunStore {
+    QuadRun *data;
+    QuadRun *scratch;
+    int size;
+    int capacity;
+    bool sorted;
+} RunStore;
+
+RunStore make_run_store() {
+    return (RunStore){
+        .data = malloc(64 * sizeof(QuadRun)),
+        .scratch = malloc(64 * sizeof(QuadRun)),
+        .size = 0,
+        .capacity = 64,
+        .sorted = true,
+    };
 }
 
+typedef struct ClipStore {
+    Rect *data;
+    int size;
+    int capacity;
+} ClipStore;
+
+// What was drawn where, in call order. Comparing it with the previous
+// frame's list tells whether the frame changed and which region did.
+typedef struct DisplayItem {
+    u64 hash;
+    Rect rect;
+} DisplayItem;
+
+typedef struct DisplayList {
+    DisplayItem *data;
+    int size;
+    int capacity;
+} DisplayList;
+
+typedef struct ClipState {
+    Rect rect;
+    int index;
+} ClipState;
+
+// A part of the screen cached in a texture of its own. Its content is
+// recorded like a static batch and rendered into the texture at the next
+// flush, then composited as one quad until it is invalidated.
+typedef struct CachedLayer {
+    u32 id;
+    Rect rect;
+    Texture texture;
+    SDL_GPUTexture *depth_texture;
+    u32 version;
+    bool valid;
+    StaticBatch *content; // recorded this frame and not rendered yet
+    u32 clip; // the layer's own rect, for the content to be clipped to
+    u32 transform_base; // where the content's transforms start in the frame's
+} CachedLayer;
+
+typedef struct CachedLayerStore {
+    CachedLayer *data;
+    int size;
+    int capacity;
+} CachedLayerStore;
+
+#define LAYER_STACK_SIZE 32
+#define BLEND_STACK_SIZE 32
+#define CLIP_STACK_SIZE 32
+#define TRANSFORM_STACK_SIZE 32
+#define MAX_CLIPS (1 << (32 - QUAD_CLIP_SHIFT))
+#define BATCH_MERGE_LOOKBACK 8
+#define RUN_KEY_LAYER_SHIFT 24
+#define RUN_KEY_BATCH_MASK ((1u << RUN_KEY_LAYER_SHIFT) - 1)
+
+// Number of frames the CPU may run ahead of the GPU. Each gets its own upload
+// region so a frame never writes memory the GPU may still be reading.
+#define FRAMES_IN_FLIGHT 3
+
+// Slots hold their quads in chunks of QUAD_CHUNK_SIZE. A chunk the slot goes
+// this many frames without using is released, unless it's the first.
+#define QUAD_CHUNK_IDLE_FRAMES 60
+
+#define MIN_RENDER_SCALE 0.25f
+// Frames to wait after a render scale change before judging the new scale
+#define RENDER_SCALE_COOLDOWN 30
+
+// Static draws at least this big are culled on the GPU when it's enabled;
+// smaller ones aren't worth the dispatches. Keep CULL_GROUP_SIZE in sync
+// with cull.comp.hlsl.
+#define GPU_CULL_MIN_QUADS 4096
+#define CULL_GROUP_SIZE 256
+#define CULL_MAX_GROUPS 65535
+
+// A fixed size piece of a slot's quad memory. Batches never span chunks, so
+// each draw reads a single chunk.
+typedef struct QuadChunk {
+    SDL_GPUTransferBuffer *transfer_buffer;
+    SDL_GPUBuffer *buffer;
+    GpuQuad *quads; // mapped transfer buffer while the frame is being built
+    int quad_count; // including any unused space before the last quad
+    int idle_frames;
+
+    // Indices of the chunk's quads in draw order, only uploaded when layers
+    // reorder quads
+    SDL_GPUTransferBuffer *order_transfer_buffer;
+    SDL_GPUBuffer *order_buffer;
+    u32 order_size;
+    u32 *order; // mapped while it's written
+    u32 order_count;
+    u32 order_next; // where the next draw starts while draws are laid out
+} QuadChunk;
+
+// A culled draw as the GPU cull check redoes it on the CPU
+typedef struct CullCheckDraw {
+    Vec2 offset;
+    u32 quad_count;
+    u32 clip_base;
+    u32 transform_base;
+} CullCheckDraw;
+
+// What a frame's GPU cull check needs once the frame's fence has signalled:
+// the indirect args and quads of its culled draws, downloaded in that order,
+// and copies of the clip and transform tables they were culled against.
+typedef struct CullCheck {
+    SDL_GPUTransferBuffer *download;
+    u32 download_size;
+    CullCheckDraw *draws;
+    int draw_count;
+    Rect *clips;
+    GpuTransform *transforms;
+} CullCheck;
+
+typedef struct FrameSlot {
+    QuadChunk *chunks;
+    int chunk_count;
+    int chunk_capacity;
+    SDL_GPUFence *fence;
+    int quad_count; // quads are numbered across chunks, the next one gets this
+    StaticBatch *freed_batches; // released once the slot's fence has signalled
+    CullCheck cull_check;
+
+    SDL_GPUTransferBuffer *clip_transfer_buffer;
+    SDL_GPUBuffer *clip_buffer;
+    u32 clip_size;
+
+    SDL_GPUTransferBuffer *transform_transfer_buffer;
+    SDL_GPUBuffer *transform_buffer;
+    u32 transform_size;
+} FrameSlot;
+
+typedef struct VertexUniforms {
+    Vec2 screen_size;
+    u32 quad_offset;
+    u32 use_order;
+    Vec2 offset;
+    u32 clip_base;
+    u32 depth_offset;
+    u32 quad_count;
+    u32 reverse;
+    u32 instanced;
+    u32 transform_base;
+    u32 culled;
+    u32 source_first;
+    u32 _padding[2];
+} VertexUniforms;
+
+typedef struct CullUniforms {
+    Vec2 offset;
+    u32 quad_first;
+    u32 quad_count;
+    u32 group_first;
+    u32 visible_first;
+    u32 args_first;
+    u32 clip_base;
+    u32 stage;
+    u32 transform_base;
+    u32 reverse;
+    u32 _padding;
+} CullUniforms;
+
 #define TEXT_BUF_LEN 32
 struct {
     AppConfig config;
     bool should_quit;
     SDL_GPUDevice *gpu;
     SDL_Window *window;
-    SDL_GPUTransferBuffer *vertex_data_transfer_buffer;
-    SDL_GPUBuffer *vertex_data_buffer;
-    SDL_GPUGraphicsPipeline *pipeline;
-    VertStore vertex_data_store;
-    u64 buf_capacity;
-    Texture last_texture;
+    FrameSlot frames[FRAMES_IN_FLIGHT];
+    int frame_index;
+    SDL_GPUShader *vertex_shader; // shared by every graphics pipeline
+    PipelineCache pipeline_cache;
+    SDL_GPUGraphicsPipeline *bound_pipeline;
+    SDL_GPUBuffer *bound_quads;
+    SDL_GPUBuffer *bound_order;
+    bool uber_only;
+    bool no_opaque_pass;
+    bool no_instancing;
+    SDL_GPUBuffer *quad_index_buffer; // one quad's two triangles, for instanced draws
+    SDL_GPUTextureFormat depth_format;
+    SDL_GPUTexture *depth_texture;
+
+    // GPU culling. Per draw offsets, the visible quads' indices and indirect
+    // draw args, written by cull.comp.hlsl and sized to the largest frame.
+    bool gpu_culling;
+    bool gpu_cull_check;
+    int cull_mismatches; // found by checks since the last flush
+    SDL_GPUComputePipeline *cull_pipeline;
+    SDL_GPUBuffer *cull_groups_buffer;
+    u32 cull_groups_size;
+    SDL_GPUBuffer *cull_visible_buffer;
+    u32 cull_visible_size;
+    SDL_GPUBuffer *cull_args_buffer;
+    u32 cull_args_size;
+
+    BatchStore batch_store;
+    DrawStore draw_store;
+    RunStore run_store;
+    int layer;
+    int layer_stack[LAYER_STACK_SIZE];
+    int layer_depth;
+    BlendMode blend;
+    BlendMode blend_stack[BLEND_STACK_SIZE];
+    int blend_depth;
+    ClipStore clip_store;
+    int clip; // index into the clip table, -1 until something is drawn in it
+    ClipState clip_stack[CLIP_STACK_SIZE];
+    int clip_depth;
+
+    // The frame's quads map through the camera and then the transform
+    // stack. transform is the two combined and transformed whether it does
+    // anything. Like clips, it gets an entry in the frame's transform table
+    // once something is drawn with it.
+    TransformStore transform_store;
+    GpuTransform camera;
+    GpuTransform local_transform; // top of the stack
+    GpuTransform transform_stack[TRANSFORM_STACK_SIZE];
+    int transform_depth;
+    GpuTransform transform;
+    GpuTransform inverse_transform; // zero when transform can't be inverted
+    bool transformed;
+    int transform_index; // -1 until something is drawn with it
     int texture_count;
     SDL_GPUSampler *sampler;
     Texture rect_texture;
     SDL_GPUCommandBuffer *cmdbuf;
     SDL_GPUTexture *swapchain_texture;
     SDL_GPURenderPass *render_pass;
+    bool should_clear;
+    Color clear_color;
+    RenderStats stats;
+    int merged_batches;
+    int culled_quads;
+    f32 drawn_area;
+    f32 opaque_area;
+    StaticBatch *recording;
+    Rect recording_cull_rect;
+    u32 static_batch_count;
+    CachedLayerStore cached_layers;
+    int active_cached_layer; // -1 outside begin_layer/end_layer
+    int cached_layer_nesting; // begin_layer calls that couldn't cache
+    ClipState cached_layer_clip;
+    Vec2 pass_size; // screen units covered by the target being drawn
+
+    // Frames are drawn into a persistent canvas and blitted to the swapchain.
+    // The canvas has the window's resolution; frames use the top left part
+    // of it at the render scale and are stretched when blitted.
+    SDL_GPUTexture *canvas;
+    Vec2 canvas_size;
+    bool canvas_valid;
+    f32 canvas_scale; // render scale of what the canvas holds
+    f32 render_scale;
+    f32 frame_time_target; // ms, 0 keeps the render scale fixed
+    f32 frame_time_average;
+    int render_scale_cooldown;
+    u64 frame_start_ns;
+    DisplayList display_lists[2];
+    int display_list;
+    bool untracked_frame;
+    Color last_clear_color;
+    u32 frame_interval_ms;
+
+    // Idle mode blocks between frames until an event or a requested redraw
+    bool idle_mode;
+    u32 redraw_event;
+    u64 redraw_deadline; // SDL_GetTicks time of the earliest timed redraw, 0 if none
+
+    Vec2 screen_size;
+    Rect cull_rect;
 
     SDL_AudioStream *stream;
 
@@ -108,8 +607,14 @@ struct {
         char textbuf[TEXT_BUF_LEN];
         int textbuf_pos;
     } input;
+
+    GlyphScratch glyphs;
 } _APP = {0};
 
+// The list this thread is drawing into, if any. While one is set the draw_*
+// functions touch nothing shared, which is what lets other threads draw.
+static THREAD_LOCAL DrawList *_draw_list;
+
 Texture load_texture_bytes(u8 *data, int w, int h, int d) {
 
     SDL_GPUTransferBuffer *texture_transfer_buffer = SDL_CreateGPUTransferBuffer(
@@ -182,12 +687,19 @@ Texture load_texture_bytes(u8 *data, int w, int h, int d) {
     int idx = _APP.texture_count;
     _APP.texture_count++;
 
+    // Opaque textures let sprites go in the opaque pass
+    bool opaque = d == 4;
+    for (int i = 3; opaque && i < w * h * d; i += 4) {
+        opaque = data[i] == 255;
+    }
+
     return (Texture){
         .handle = handle,
         .w = w,
         .h = h,
         .d = d,
         .idx = idx,
+        .opaque = opaque,
     };
 }
 
@@ -244,6 +756,68 @@ Font load_font(const char* filename, float size) {
     return font;
 }
 
+#define SPIRV_OP_DECORATE 71
+#define SPIRV_DECORATION_BINDING 33
+#define SPIRV_DECORATION_DESCRIPTOR_SET 34
+
+// The .spv files are built from the .hlsl sources by build.bat and have to be
+// rebuilt whenever a shader or its resource layout changes
+static void *sdl_read_shader(char *filename, size_t *len) {
+    void *code = SDL_LoadFile(filename, len);
+    if (!code) {
+        SDL_Log("Error: can't read %s (%s); compile the shaders with build.bat", filename, SDL_GetError());
+        SDL_Quit();
+        exit(1);
+    }
+    return code;
+}
+
+// Checks that SPIR-V code binds exactly count resources in a descriptor set,
+// numbered from 0 as SDL expects. A .spv built from an older version of its
+// shader fails this instead of being bound with the wrong resources.
+static void sdl_check_shader_set(char *filename, void *code, size_t len, u32 set, int count) {
+    const u32 *words = code;
+    size_t word_count = len / 4;
+    u32 bindings = 0;
+    if (word_count >= 5 && words[0] == 0x07230203) {
+        // Result ids are below the header's bound; OpDecorate sets them
+        u32 bound = words[3];
+        int *sets = malloc(bound * sizeof(int));
+        int *slots = malloc(bound * sizeof(int));
+        for (u32 id = 0; id < bound; id++) {
+            sets[id] = -1;
+            slots[id] = -1;
+        }
+        for (size_t i = 5; i < word_count;) {
+            u32 opcode = words[i] & 0xffff;
+            u32 length = words[i] >> 16;
+            if (length == 0 || i + length > word_count) {
+                break;
+            }
+            if (opcode == SPIRV_OP_DECORATE && length >= 4 && words[i + 1] < bound) {
+                if (words[i + 2] == SPIRV_DECORATION_DESCRIPTOR_SET) {
+                    sets[words[i + 1]] = words[i + 3];
+                } else if (words[i + 2] == SPIRV_DECORATION_BINDING) {
+                    slots[words[i + 1]] = words[i + 3];
+                }
+            }
+            i += length;
+        }
+        for (u32 id = 0; id < bound; id++) {
+            if (sets[id] == (int)set && slots[id] >= 0 && slots[id] < 32) {
+                bindings |= 1u << slots[id];
+            }
+        }
+        free(sets);
+        free(slots);
+    }
+    if (bindings != (1u << count) - 1) {
+        SDL_Log("Error: %s doesn't bind %d resources in set %u; compile the shaders with build.bat", filename, count, set);
+        SDL_Quit();
+        exit(1);
+    }
+}
+
 static SDL_GPUShader *sdl_load_shader(
     SDL_GPUDevice *gpu,
     char *filename,
@@ -254,7 +828,14 @@ static SDL_GPUShader *sdl_load_shader(
     int num_uniform_buffers
 ) {
     size_t len;
-    unsigned char *data = os_read_file(filename, &len);
+    void *data = sdl_read_shader(filename, &len);
+
+    // SDL's SPIR-V layout: vertex resources in set 0 and uniforms in set 1,
+    // fragment ones in sets 2 and 3
+    u32 resource_set = stage == SDL_GPU_SHADERSTAGE_VERTEX ? 0 : 2;
+    sdl_check_shader_set(filename, data, len, resource_set, num_samplers + num_storage_textures + num_storage_buffers);
+    sdl_check_shader_set(filename, data, len, resource_set + 1, num_uniform_buffers);
+
     SDL_GPUShaderCreateInfo info = {
         .code_size = len,
         .code = data,
@@ -269,9 +850,114 @@ static SDL_GPUShader *sdl_load_shader(
 
     SDL_GPUShader *shader = SDL_CreateGPUShader(gpu, &info);
     ASSERT_CREATED(shader);
+    SDL_free(data);
     return shader;
 }
 
+// Alpha is always accumulated as coverage, so what is drawn into a cleared
+// layer texture ends up premultiplied, and layers are composited that way.
+// Multiplied quads are shaded premultiplied (QUAD_PREMULTIPLY), which lets
+// them fade to the destination where their alpha does.
+static SDL_GPUColorTargetBlendState blend_state(BlendMode blend, bool opaque) {
+    SDL_GPUColorTargetBlendState state = {
+        .enable_blend = !opaque,
+        .color_blend_op = SDL_GPU_BLENDOP_ADD,
+        .alpha_blend_op = SDL_GPU_BLENDOP_ADD,
+        .src_color_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA,
+        .dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+        .src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE,
+        .dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+    };
+    switch (blend) {
+        case BLEND_ALPHA:
+            break;
+        case BLEND_PREMULTIPLIED:
+            state.src_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            break;
+        case BLEND_ADDITIVE:
+            state.dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE;
+            break;
+        case BLEND_MULTIPLY:
+            state.src_color_blendfactor = SDL_GPU_BLENDFACTOR_DST_COLOR;
+            break;
+    }
+    return state;
+}
+
+// Every pipeline tests against the depth buffer, so nothing is drawn over
+// opaque quads in front of it. Only opaque pipelines write depth, and they
+// don't blend.
+static SDL_GPUGraphicsPipeline *sdl_create_pipeline(PipelineState state) {
+    PipelineKind kind = state.kind;
+    int num_samplers = pipeline_samples(kind) ? MAX_TEXTURE_SLOTS : 0;
+    SDL_GPUShader *fragment_shader = sdl_load_shader(_APP.gpu, pipeline_fragment_shaders[kind], SDL_GPU_SHADERSTAGE_FRAGMENT, num_samplers, 0, 0, 0);
+    bool opaque = pipeline_is_opaque(kind);
+
+    SDL_GPUGraphicsPipeline *pipeline = SDL_CreateGPUGraphicsPipeline(
+		_APP.gpu,
+		&(SDL_GPUGraphicsPipelineCreateInfo){
+			.target_info = (SDL_GPUGraphicsPipelineTargetInfo){
+				.num_color_targets = 1,
+				.color_target_descriptions = (SDL_GPUColorTargetDescription[]){{
+					.format = SDL_GetGPUSwapchainTextureFormat(_APP.gpu, _APP.window),
+					.blend_state = blend_state(state.blend, opaque),
+				}},
+				.has_depth_stencil_target = true,
+				.depth_stencil_format = _APP.depth_format,
+			},
+			.depth_stencil_state = {
+				.enable_depth_test = true,
+				.enable_depth_write = opaque,
+				.compare_op = SDL_GPU_COMPAREOP_LESS,
+			},
+			.primitive_type = SDL_GPU_PRIMITIVETYPE_TRIANGLELIST,
+			.vertex_shader = _APP.vertex_shader,
+			.fragment_shader = fragment_shader,
+		}
+	);
+    ASSERT_CREATED(pipeline);
+
+    SDL_ReleaseGPUShader(_APP.gpu, fragment_shader);
+    return pipeline;
+}
+
+// Returns the pipeline for state, creating it the first time. The cache is
+// an open addressed table that is never more than half full.
+static SDL_GPUGraphicsPipeline *sdl_get_pipeline(PipelineState state) {
+    PipelineCache *cache = &_APP.pipeline_cache;
+    u64 hash = hash_words(HASH_SEED, &state, sizeof(state));
+    if (2 * (cache->size + 1) > cache->capacity) {
+        PipelineCache grown = {
+            .data = calloc(SDL_max(32, cache->capacity * 2), sizeof(PipelineCacheEntry)),
+            .size = cache->size,
+            .capacity = SDL_max(32, cache->capacity * 2),
+        };
+        for (int i = 0; i < cache->capacity; i++) {
+            PipelineCacheEntry *entry = &cache->data[i];
+            if (entry->pipeline) {
+                int j = entry->hash & (grown.capacity - 1);
+                while (grown.data[j].pipeline) {
+                    j = (j + 1) & (grown.capacity - 1);
+                }
+                grown.data[j] = *entry;
+            }
+        }
+        free(cache->data);
+        *cache = grown;
+    }
+
+    int i = hash & (cache->capacity - 1);
+    for (; cache->data[i].pipeline; i = (i + 1) & (cache->capacity - 1)) {
+        PipelineCacheEntry *entry = &cache->data[i];
+        if (entry->hash == hash && SDL_memcmp(&entry->state, &state, sizeof(state)) == 0) {
+            return entry->pipeline;
+        }
+    }
+    cache->data[i] = (PipelineCacheEntry){hash, state, sdl_create_pipeline(state)};
+    cache->size++;
+    return cache->data[i].pipeline;
+}
+
 void sdl_init_keymap() {
     _APP.input.keymap[SDL_SCANCODE_SPACE] = KEY_SPACE;
     _APP.input.keymap[SDL_SCANCODE_APOSTROPHE] = KEY_APOSTROPHE;
@@ -395,6 +1081,10 @@ void sdl_init_keymap() {
     _APP.input.keymap[SDL_SCANCODE_MENU] = KEY_MENU;
 }
 
+void app_configure(AppConfig config) {
+    _APP.config = config;
+}
+
 void app_init() {
 
     ASSERT_CALL(SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO));
@@ -418,42 +1108,99 @@ void app_init() {
 
     _APP.window = SDL_CreateWindow(title, width, height, 0);
     ASSERT_CREATED(_APP.window);
+    _APP.screen_size = (Vec2){width, height};
+    _APP.cull_rect = (Rect){0, 0, width, height};
+
+    // Clip 0 is the whole window and is what quads use outside any clip
+    _APP.clip_store = (ClipStore){
+        .data = malloc(64 * sizeof(Rect)),
+        .size = 1,
+        .capacity = 64,
+    };
+    _APP.clip_store.data[0] = _APP.cull_rect;
+    _APP.transform_store = make_transform_store();
+    _APP.camera = _APP.transform_store.data[0];
+    _APP.local_transform = _APP.camera;
+    _APP.transform = _APP.camera;
 
     _APP.gpu = SDL_CreateGPUDevice(SDL_GPU_SHADERFORMAT_SPIRV, true, NULL);
     ASSERT_CREATED(_APP.gpu);
     ASSERT_CALL(SDL_ClaimWindowForGPUDevice(_APP.gpu, _APP.window));
+    if (_APP.config.no_vsync && SDL_WindowSupportsGPUPresentMode(_APP.gpu, _APP.window, SDL_GPU_PRESENTMODE_IMMEDIATE)) {
+        ASSERT_CALL(SDL_SetGPUSwapchainParameters(_APP.gpu, _APP.window, SDL_GPU_SWAPCHAINCOMPOSITION_SDR, SDL_GPU_PRESENTMODE_IMMEDIATE));
+    }
 
-    SDL_GPUShader *vertex_shader = sdl_load_shader(_APP.gpu, "shaders/2d.vert.spv", SDL_GPU_SHADERSTAGE_VERTEX, 0, 0, 1, 1);
-    SDL_GPUShader *fragment_shader = sdl_load_shader(_APP.gpu, "shaders/2d.frag.spv", SDL_GPU_SHADERSTAGE_FRAGMENT, 1, 0, 0, 1);
+    // Depth orders opaque quads, which needs a depth per quad of the frame
+    _APP.depth_format = SDL_GPU_TEXTUREFORMAT_D24_UNORM;
+    if (SDL_GPUTextureSupportsFormat(_APP.gpu, SDL_GPU_TEXTUREFORMAT_D32_FLOAT, SDL_GPU_TEXTURETYPE_2D, SDL_GPU_TEXTUREUSAGE_DEPTH_STENCIL_TARGET)) {
+        _APP.depth_format = SDL_GPU_TEXTUREFORMAT_D32_FLOAT;
+    }
 
-    // Pipeline
-    _APP.pipeline = SDL_CreateGPUGraphicsPipeline(
-		_APP.gpu,
-		&(SDL_GPUGraphicsPipelineCreateInfo){
-			.target_info = (SDL_GPUGraphicsPipelineTargetInfo){
-				.num_color_targets = 1,
-				.color_target_descriptions = (SDL_GPUColorTargetDescription[]){{
-					.format = SDL_GetGPUSwapchainTextureFormat(_APP.gpu, _APP.window),
-					.blend_state = {
-						.enable_blend = true,
-						.color_blend_op = SDL_GPU_BLENDOP_ADD,
-						.alpha_blend_op = SDL_GPU_BLENDOP_ADD,
-						.src_color_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA,
-						.dst_color_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-						.src_alpha_blendfactor = SDL_GPU_BLENDFACTOR_SRC_ALPHA,
-						.dst_alpha_blendfactor = SDL_GPU_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
-					}
-				}}
-			},
-			.primitive_type = SDL_GPU_PRIMITIVETYPE_TRIANGLELIST,
-			.vertex_shader = vertex_shader,
-			.fragment_shader = fragment_shader,
-		}
-	);
-    ASSERT_CREATED(_APP.pipeline);
+    // All pipelines share the vertex shader and differ in the fragment stage
+    // and blending. They are created as they are first drawn with.
+    _APP.vertex_shader = sdl_load_shader(_APP.gpu, "shaders/2d_quad.vert.spv", SDL_GPU_SHADERSTAGE_VERTEX, 0, 0, 4, 1);
 
-    SDL_ReleaseGPUShader(_APP.gpu, vertex_shader);
-    SDL_ReleaseGPUShader(_APP.gpu, fragment_shader);
+    size_t cull_len;
+    void *cull_code = sdl_read_shader("shaders/cull.comp.spv", &cull_len);
+    sdl_check_shader_set("shaders/cull.comp.spv", cull_code, cull_len, 0, 3);
+    sdl_check_shader_set("shaders/cull.comp.spv", cull_code, cull_len, 1, 3);
+    sdl_check_shader_set("shaders/cull.comp.spv", cull_code, cull_len, 2, 1);
+    _APP.cull_pipeline = SDL_CreateGPUComputePipeline(
+        _APP.gpu,
+        &(SDL_GPUComputePipelineCreateInfo){
+            .code_size = cull_len,
+            .code = cull_code,
+            .entrypoint = "main",
+            .format = SDL_GPU_SHADERFORMAT_SPIRV,
+            .num_readonly_storage_buffers = 3,
+            .num_readwrite_storage_buffers = 3,
+            .num_uniform_buffers = 1,
+            .threadcount_x = CULL_GROUP_SIZE,
+            .threadcount_y = 1,
+            .threadcount_z = 1,
+        }
+    );
+    ASSERT_CREATED(_APP.cull_pipeline);
+    SDL_free(cull_code);
+
+    // Canvas
+    int canvas_w, canvas_h;
+    ASSERT_CALL(SDL_GetWindowSizeInPixels(_APP.window, &canvas_w, &canvas_h));
+    _APP.canvas = SDL_CreateGPUTexture(
+        _APP.gpu,
+        &(SDL_GPUTextureCreateInfo){
+            .type = SDL_GPU_TEXTURETYPE_2D,
+            .format = SDL_GetGPUSwapchainTextureFormat(_APP.gpu, _APP.window),
+            .width = canvas_w,
+            .height = canvas_h,
+            .layer_count_or_depth = 1,
+            .num_levels = 1,
+            .usage = SDL_GPU_TEXTUREUSAGE_COLOR_TARGET | SDL_GPU_TEXTUREUSAGE_SAMPLER,
+        }
+    );
+    ASSERT_CREATED(_APP.canvas);
+    _APP.canvas_size = (Vec2){canvas_w, canvas_h};
+    _APP.render_scale = 1.0f;
+    _APP.active_cached_layer = -1;
+
+    _APP.depth_texture = SDL_CreateGPUTexture(
+        _APP.gpu,
+        &(SDL_GPUTextureCreateInfo){
+            .type = SDL_GPU_TEXTURETYPE_2D,
+            .format = _APP.depth_format,
+            .width = canvas_w,
+            .height = canvas_h,
+            .layer_count_or_depth = 1,
+            .num_levels = 1,
+            .usage = SDL_GPU_TEXTUREUSAGE_DEPTH_STENCIL_TARGET,
+        }
+    );
+    ASSERT_CREATED(_APP.depth_texture);
+
+    const SDL_DisplayMode *mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(_APP.window));
+    f32 refresh_rate = mode && mode->refresh_rate > 0.0f ? mode->refresh_rate : 60.0f;
+    _APP.frame_interval_ms = (u32)(1000.0f / refresh_rate);
+    _APP.redraw_event = SDL_RegisterEvents(1);
 
     // Textures
 
@@ -470,386 +1217,2609 @@ void app_init() {
     );
 
     // Buffer data
-    _APP.vertex_data_store = make_vert_store();
+    _APP.batch_store = make_batch_store();
+    _APP.run_store = make_run_store();
+    _APP.draw_store = (DrawStore){
+        .data = malloc(64 * sizeof(Draw)),
+        .size = 0,
+        .capacity = 64,
+    };
+
+    u8 bytes[4] = {0, 0, 0, 0};
+    _APP.rect_texture = load_texture_bytes(bytes, 1, 1, 4);
 
-    _APP.vertex_data_transfer_buffer = SDL_CreateGPUTransferBuffer(
+    // Instanced draws run one instance per quad over these six indices
+    u16 indices[6] = {0, 1, 2, 2, 3, 0};
+    SDL_GPUTransferBuffer *index_transfer_buffer = SDL_CreateGPUTransferBuffer(
         _APP.gpu,
         &(SDL_GPUTransferBufferCreateInfo){
             .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
-            .size = _APP.vertex_data_store.capacity * sizeof(GpuQuad),
+            .size = sizeof(indices),
         }
     );
+    ASSERT_CREATED(index_transfer_buffer);
+    u16 *mapped_indices = SDL_MapGPUTransferBuffer(_APP.gpu, index_transfer_buffer, false);
+    SDL_memcpy(mapped_indices, indices, sizeof(indices));
+    SDL_UnmapGPUTransferBuffer(_APP.gpu, index_transfer_buffer);
 
-    _APP.vertex_data_buffer = SDL_CreateGPUBuffer(
+    _APP.quad_index_buffer = SDL_CreateGPUBuffer(
         _APP.gpu,
         &(SDL_GPUBufferCreateInfo){
-            .usage = SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ,
-            .size = _APP.vertex_data_store.capacity * sizeof(GpuQuad),
+            .usage = SDL_GPU_BUFFERUSAGE_INDEX,
+            .size = sizeof(indices),
         }
     );
+    ASSERT_CREATED(_APP.quad_index_buffer);
 
-    _APP.buf_capacity = _APP.vertex_data_store.capacity;
-
-    u8 bytes[4] = {0, 0, 0, 0};
-    _APP.rect_texture = load_texture_bytes(bytes, 1, 1, 4);
-    _APP.last_texture = _APP.rect_texture;
+    SDL_GPUCommandBuffer *upload_cmd_buf = SDL_AcquireGPUCommandBuffer(_APP.gpu);
+    SDL_GPUCopyPass *copy_pass = SDL_BeginGPUCopyPass(upload_cmd_buf);
+    SDL_UploadToGPUBuffer(
+        copy_pass,
+        &(SDL_GPUTransferBufferLocation){
+            .transfer_buffer = index_transfer_buffer,
+            .offset = 0,
+        },
+        &(SDL_GPUBufferRegion){
+            .buffer = _APP.quad_index_buffer,
+            .offset = 0,
+            .size = sizeof(indices),
+        },
+        false
+    );
+    SDL_EndGPUCopyPass(copy_pass);
+    SDL_SubmitGPUCommandBuffer(upload_cmd_buf);
+    SDL_ReleaseGPUTransferBuffer(_APP.gpu, index_transfer_buffer);
 }
 
 void app_quit() {
     _APP.should_quit = true;
 }
 
-void sdl_begin_frame() {
-    _APP.cmdbuf = SDL_AcquireGPUCommandBuffer(_APP.gpu);
-    ASSERT_CREATED(_APP.cmdbuf);
+// Returns where count quads, at most a chunk's worth, go in the frame: right
+// after the last ones if they fit in the same chunk, otherwise at the start
+// of the next. The end of a chunk skipped this way is never drawn.
+static int sdl_chunk_fit(int next, int count) {
+    int room = QUAD_CHUNK_SIZE - next % QUAD_CHUNK_SIZE;
+    return count <= room ? next : next + room;
+}
 
-    _APP.swapchain_texture = NULL;
-    ASSERT_CALL(SDL_AcquireGPUSwapchainTexture(_APP.cmdbuf, _APP.window, &_APP.swapchain_texture, NULL, NULL));
+static void sdl_create_quad_chunk(QuadChunk *chunk) {
+    *chunk = (QuadChunk){0};
+    chunk->transfer_buffer = SDL_CreateGPUTransferBuffer(
+        _APP.gpu,
+        &(SDL_GPUTransferBufferCreateInfo){
+            .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+            .size = QUAD_CHUNK_SIZE * sizeof(GpuQuad),
+        }
+    );
+    ASSERT_CREATED(chunk->transfer_buffer);
+    chunk->buffer = SDL_CreateGPUBuffer(
+        _APP.gpu,
+        &(SDL_GPUBufferCreateInfo){
+            .usage = SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ,
+            .size = QUAD_CHUNK_SIZE * sizeof(GpuQuad),
+        }
+    );
+    ASSERT_CREATED(chunk->buffer);
 }
 
-void sdl_end_frame() {
-    SDL_SubmitGPUCommandBuffer(_APP.cmdbuf);
+// Releasing is deferred by SDL until the GPU is done with the buffers
+static void sdl_release_quad_chunk(QuadChunk *chunk) {
+    SDL_ReleaseGPUTransferBuffer(_APP.gpu, chunk->transfer_buffer);
+    SDL_ReleaseGPUBuffer(_APP.gpu, chunk->buffer);
+    if (chunk->order_buffer) {
+        SDL_ReleaseGPUTransferBuffer(_APP.gpu, chunk->order_transfer_buffer);
+        SDL_ReleaseGPUBuffer(_APP.gpu, chunk->order_buffer);
+    }
 }
 
-void sdl_flush() {
-    if (_APP.vertex_data_store.size == 0) {
-        return;
+// Returns where to write quads first to first + count - 1, as placed by
+// sdl_chunk_fit, and moves the frame's end past them. A new chunk is added
+// when they start one the slot doesn't have yet; nothing is ever moved.
+static GpuQuad *sdl_reserve_frame_quads(FrameSlot *slot, int first, int count) {
+    int index = first / QUAD_CHUNK_SIZE;
+    if (index == slot->chunk_count) {
+        if (slot->chunk_count == slot->chunk_capacity) {
+            slot->chunk_capacity = SDL_max(4, slot->chunk_capacity * 2);
+            slot->chunks = realloc(slot->chunks, slot->chunk_capacity * sizeof(QuadChunk));
+        }
+        sdl_create_quad_chunk(&slot->chunks[slot->chunk_count]);
+        slot->chunk_count++;
     }
 
-    if (_APP.buf_capacity != _APP.vertex_data_store.capacity) {
-        SDL_ReleaseGPUTransferBuffer(_APP.gpu, _APP.vertex_data_transfer_buffer);
-        _APP.vertex_data_transfer_buffer = SDL_CreateGPUTransferBuffer(
-            _APP.gpu,
-            &(SDL_GPUTransferBufferCreateInfo){
-                .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
-                .size = _APP.vertex_data_store.capacity * sizeof(GpuQuad),
-            }
-        );
-        SDL_ReleaseGPUBuffer(_APP.gpu, _APP.vertex_data_buffer);
-        _APP.vertex_data_buffer = SDL_CreateGPUBuffer(
-            _APP.gpu,
-            &(SDL_GPUBufferCreateInfo){
-                .usage = SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ,
-                .size = _APP.vertex_data_store.capacity * sizeof(GpuQuad),
-            }
-        );
-        _APP.buf_capacity = _APP.vertex_data_store.capacity;
+    // The slot's fence has already been waited on, so nothing else can be
+    // using the chunk
+    QuadChunk *chunk = &slot->chunks[index];
+    if (!chunk->quads) {
+        chunk->quads = SDL_MapGPUTransferBuffer(_APP.gpu, chunk->transfer_buffer, false);
     }
+    chunk->quad_count = first % QUAD_CHUNK_SIZE + count;
+    slot->quad_count = first + count;
+    return chunk->quads + first % QUAD_CHUNK_SIZE;
+}
 
-    if (_APP.swapchain_texture) {
+static void sdl_release_static_batch(StaticBatch *sb) {
+    if (sb->buffer) {
+        SDL_ReleaseGPUBuffer(_APP.gpu, sb->buffer);
+    }
+    free(sb->quads);
+    free(sb->batches.data);
+    free(sb->transforms.data);
+    free(sb);
+}
 
-        if (_APP.vertex_data_store.size > 0) {
+// Redoes each draw the slot's frame culled on the GPU with the same bounds
+// math as cull.comp.hlsl and compares how many quads were found visible
+static void sdl_finish_cull_check(CullCheck *check) {
+    u8 *data = SDL_MapGPUTransferBuffer(_APP.gpu, check->download, false);
+    SDL_GPUIndirectDrawCommand *args = (SDL_GPUIndirectDrawCommand *)data;
+    GpuQuad *quads = (GpuQuad *)(args + check->draw_count);
+    for (int i = 0; i < check->draw_count; i++) {
+        CullCheckDraw *draw = &check->draws[i];
+        u32 visible = 0;
+        for (u32 j = 0; j < draw->quad_count; j++) {
+            GpuQuad *q = &quads[j];
+            Rect clip = check->clips[draw->clip_base + (q->flags >> QUAD_CLIP_SHIFT)];
+            GpuTransform t = check->transforms[draw->transform_base + q->transform];
+            Vec2 center = {
+                .x = t.m.columns[0].x * (q->dst_rect.x + q->dst_rect.w / 2) + t.m.columns[1].x * (q->dst_rect.y + q->dst_rect.h / 2) + t.t.x + draw->offset.x,
+                .y = t.m.columns[0].y * (q->dst_rect.x + q->dst_rect.w / 2) + t.m.columns[1].y * (q->dst_rect.y + q->dst_rect.h / 2) + t.t.y + draw->offset.y,
+            };
+            Vec2 extent = {
+                .x = (SDL_fabsf(t.m.columns[0].x) * q->dst_rect.w + SDL_fabsf(t.m.columns[1].x) * q->dst_rect.h) / 2,
+                .y = (SDL_fabsf(t.m.columns[0].y) * q->dst_rect.w + SDL_fabsf(t.m.columns[1].y) * q->dst_rect.h) / 2,
+            };
+            visible += center.x - extent.x < clip.x + clip.w && center.x + extent.x > clip.x &&
+                center.y - extent.y < clip.y + clip.h && center.y + extent.y > clip.y;
+        }
+        if (args[i].num_vertices != visible * 6) {
+            SDL_Log("GPU cull check: draw %d of %u quads has %u visible on the GPU and %u on the CPU",
+                i, draw->quad_count, args[i].num_vertices / 6, visible);
+            _APP.cull_mismatches++;
+        }
+        quads += draw->quad_count;
+    }
+    SDL_UnmapGPUTransferBuffer(_APP.gpu, check->download);
+    check->draw_count = 0;
+}
 
-            GpuQuad *data_ptr = SDL_MapGPUTransferBuffer(_APP.gpu, _APP.vertex_data_transfer_buffer, true);
+void sdl_begin_frame() {
+    // Wait until the GPU has finished the last frame that used this slot
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    // Batches freed during a skipped frame stay queued until the slot is
+    // submitted, since only its fence comes after the frames that drew them
+    if (slot->fence) {
+        SDL_WaitForGPUFences(_APP.gpu, true, &slot->fence, 1);
+        SDL_ReleaseGPUFence(_APP.gpu, slot->fence);
+        slot->fence = NULL;
+        while (slot->freed_batches) {
+            StaticBatch *sb = slot->freed_batches;
+            slot->freed_batches = sb->next_freed;
+            sdl_release_static_batch(sb);
+        }
+    }
+    if (slot->cull_check.draw_count > 0) {
+        sdl_finish_cull_check(&slot->cull_check);
+    }
 
-            for (int i = 0; i < _APP.vertex_data_store.size; i++) {
-                data_ptr[i] = _APP.vertex_data_store.data[i];
-            }
+    // The command buffer and swapchain texture are only acquired once
+    // sdl_flush knows the frame has to be drawn
+    _APP.cmdbuf = NULL;
+    _APP.swapchain_texture = NULL;
+}
 
-            SDL_UnmapGPUTransferBuffer(_APP.gpu, _APP.vertex_data_transfer_buffer);
-
-            SDL_GPUCopyPass *copy_pass = SDL_BeginGPUCopyPass(_APP.cmdbuf);
-            SDL_UploadToGPUBuffer(
-                    copy_pass,
-                    &(SDL_GPUTransferBufferLocation) {
-                    .transfer_buffer = _APP.vertex_data_transfer_buffer,
-                    .offset = 0,
-                    },
-                    &(SDL_GPUBufferRegion) {
-                    .buffer = _APP.vertex_data_buffer,
-                    .offset = 0,
-                    .size = _APP.vertex_data_store.size * sizeof(GpuQuad),
-                    },
-                    true
-                    );
-            SDL_EndGPUCopyPass(copy_pass);
-        }
-
-        _APP.render_pass = SDL_BeginGPURenderPass(
-            _APP.cmdbuf,
-            &(SDL_GPUColorTargetInfo){
-                .texture = _APP.swapchain_texture,
-                .cycle = false,
-                .load_op = SDL_GPU_LOADOP_LOAD,
-                .store_op = SDL_GPU_STOREOP_STORE,
-            },
-            1,
-            NULL
-        );
+void sdl_end_frame() {
+    if (!_APP.cmdbuf) {
+        return;
+    }
 
-        SDL_BindGPUGraphicsPipeline(_APP.render_pass, _APP.pipeline);
+    // Layer content has been rendered into the layer textures. Freeing it
+    // before the slot advances releases it once this frame's fence signals.
+    for (int i = 0; i < _APP.cached_layers.size; i++) {
+        CachedLayer *layer = &_APP.cached_layers.data[i];
+        if (layer->content) {
+            free_static_batch(layer->content);
+            layer->content = NULL;
+        }
+    }
 
-        SDL_BindGPUFragmentSamplers(
-                _APP.render_pass,
-                0,
-                &(SDL_GPUTextureSamplerBinding){
-                .texture = _APP.last_texture.handle,
-                .sampler = _APP.sampler,
-                },
-                1
-                );
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    slot->fence = SDL_SubmitGPUCommandBufferAndAcquireFence(_APP.cmdbuf);
+    _APP.frame_index = (_APP.frame_index + 1) % FRAMES_IN_FLIGHT;
+}
 
-        SDL_BindGPUVertexStorageBuffers(_APP.render_pass, 0, &_APP.vertex_data_buffer, 1);
-        SDL_PushGPUVertexUniformData(_APP.cmdbuf, 0, &(Vec2){800.0f, 600.0f}, sizeof(Vec2));
-        SDL_PushGPUFragmentUniformData(_APP.cmdbuf, 0, &(Vec2){800.0f, 600.0f}, sizeof(Vec2));
+// Stable LSD radix sort on the run keys, 8 bits per pass. Passes where every
+// key has the same byte are skipped, which is most of them in practice.
+static void radix_sort_runs(RunStore *runs) {
+    QuadRun *src = runs->data;
+    QuadRun *dst = runs->scratch;
 
-        SDL_DrawGPUPrimitives(_APP.render_pass, _APP.vertex_data_store.size * 6, 1, 0, 0);
-        SDL_EndGPURenderPass(_APP.render_pass);
+    for (int shift = 0; shift < 32; shift += 8) {
+        int offsets[256] = {0};
+        for (int i = 0; i < runs->size; i++) {
+            offsets[(src[i].key >> shift) & 0xff]++;
+        }
+        if (offsets[(src[0].key >> shift) & 0xff] == runs->size) {
+            continue;
+        }
+
+        int total = 0;
+        for (int i = 0; i < 256; i++) {
+            int count = offsets[i];
+            offsets[i] = total;
+            total += count;
+        }
+        for (int i = 0; i < runs->size; i++) {
+            dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+        }
+
+        QuadRun *tmp = src;
+        src = dst;
+        dst = tmp;
     }
 
-    _APP.vertex_data_store.size = 0;
+    runs->data = src;
+    runs->scratch = dst;
 }
 
-void sdl_process_events() {
-    SDL_Event e;
+// Makes sure a per-slot storage buffer and its upload buffer hold at least
+// size bytes
+static void sdl_reserve_storage(SDL_GPUTransferBuffer **transfer_buffer, SDL_GPUBuffer **buffer, u32 *capacity, u32 size) {
+    if (*capacity >= size) {
+        return;
+    }
+    if (*transfer_buffer) {
+        SDL_ReleaseGPUTransferBuffer(_APP.gpu, *transfer_buffer);
+        SDL_ReleaseGPUBuffer(_APP.gpu, *buffer);
+    }
+    *transfer_buffer = SDL_CreateGPUTransferBuffer(
+        _APP.gpu,
+        &(SDL_GPUTransferBufferCreateInfo){
+            .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+            .size = size,
+        }
+    );
+    ASSERT_CREATED(*transfer_buffer);
+    *buffer = SDL_CreateGPUBuffer(
+        _APP.gpu,
+        &(SDL_GPUBufferCreateInfo){
+            .usage = SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ | SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ,
+            .size = size,
+        }
+    );
+    ASSERT_CREATED(*buffer);
+    *capacity = size;
+}
 
-    _APP.input.textbuf_pos = 0;
-    for (int i = 0; i < KEY_COUNT; i++) {
-        _APP.input.keys_pressed[i] = false;
-        _APP.input.keys_released[i] = false;
+// Grows a buffer only the GPU writes, dropping its contents
+static void sdl_reserve_gpu_buffer(SDL_GPUBuffer **buffer, u32 *capacity, u32 size, SDL_GPUBufferUsageFlags usage) {
+    if (*capacity >= size) {
+        return;
     }
-    for (int i = 0; i < TEXT_BUF_LEN; i++) {
-        _APP.input.textbuf[i] = '\0';
+    if (*buffer) {
+        SDL_ReleaseGPUBuffer(_APP.gpu, *buffer);
     }
-    for (int i = 0; i < BUTTON_COUNT; i++) {
-        _APP.input.buttons_pressed[i] = false;
-        _APP.input.buttons_released[i] = false;
+    size = SDL_max(size, *capacity * 2);
+    *buffer = SDL_CreateGPUBuffer(
+        _APP.gpu,
+        &(SDL_GPUBufferCreateInfo){
+            .usage = usage,
+            .size = size,
+        }
+    );
+    ASSERT_CREATED(*buffer);
+    *capacity = size;
+}
+
+#ifdef CHECK_QUAD_RUNS
+// Batches are drawn straight from the quad buffer when runs are sorted, which
+// is only right if each batch's runs are consecutive and cover one range
+// from its first quad
+static bool runs_are_batch_ranges(RunStore *runs, BatchStore *batches) {
+    for (int i = 0; i < runs->size; i++) {
+        QuadRun *run = &runs->data[i];
+        QuadRun *previous = i > 0 ? &runs->data[i - 1] : NULL;
+        u32 batch_index = run->key & RUN_KEY_BATCH_MASK;
+        if (previous && (previous->key & RUN_KEY_BATCH_MASK) == batch_index) {
+            if (run->first != previous->first + previous->count) {
+                return false;
+            }
+        } else if (run->first != batches->data[batch_index].first ||
+                (previous && (previous->key & RUN_KEY_BATCH_MASK) > batch_index)) {
+            return false;
+        }
     }
+    return true;
+}
+#endif
 
-    while (SDL_PollEvent(&e)) {
-        switch (e.type) {
-            case SDL_EVENT_QUIT:
-                {
-                    _APP.should_quit = true;
+// Writes the quad indices of the sorted runs into the order buffers of the
+// chunks holding them. A batch's runs are all in the batch's chunk.
+static void sdl_write_quad_order(FrameSlot *slot, RunStore *runs, BatchStore *batches) {
+    for (int i = 0; i < slot->chunk_count; i++) {
+        slot->chunks[i].order_count = 0;
+    }
+    for (int i = 0; i < runs->size; i++) {
+        QuadRun *run = &runs->data[i];
+        if (batches->data[run->key & RUN_KEY_BATCH_MASK].source) {
+            continue;
+        }
+        QuadChunk *chunk = &slot->chunks[run->first / QUAD_CHUNK_SIZE];
+        if (!chunk->order) {
+            sdl_reserve_storage(&chunk->order_transfer_buffer, &chunk->order_buffer, &chunk->order_size, QUAD_CHUNK_SIZE * sizeof(u32));
+            chunk->order = SDL_MapGPUTransferBuffer(_APP.gpu, chunk->order_transfer_buffer, false);
+        }
+        u32 first = run->first % QUAD_CHUNK_SIZE;
+        for (int j = 0; j < run->count; j++) {
+            chunk->order[chunk->order_count++] = first + j;
+        }
+    }
+
+    for (int i = 0; i < slot->chunk_count; i++) {
+        QuadChunk *chunk = &slot->chunks[i];
+        if (chunk->order) {
+            SDL_UnmapGPUTransferBuffer(_APP.gpu, chunk->order_transfer_buffer);
+            chunk->order = NULL;
+        }
+    }
+}
+
+static void sdl_write_clip_table(FrameSlot *slot, ClipStore *clips) {
+    u32 size = clips->capacity * sizeof(Rect);
+    sdl_reserve_storage(&slot->clip_transfer_buffer, &slot->clip_buffer, &slot->clip_size, size);
+
+    Rect *data = SDL_MapGPUTransferBuffer(_APP.gpu, slot->clip_transfer_buffer, false);
+    memcpy(data, clips->data, clips->size * sizeof(Rect));
+    SDL_UnmapGPUTransferBuffer(_APP.gpu, slot->clip_transfer_buffer);
+}
+
+static void sdl_write_transform_table(FrameSlot *slot, TransformStore *transforms) {
+    u32 size = transforms->capacity * sizeof(GpuTransform);
+    sdl_reserve_storage(&slot->transform_transfer_buffer, &slot->transform_buffer, &slot->transform_size, size);
+
+    GpuTransform *data = SDL_MapGPUTransferBuffer(_APP.gpu, slot->transform_transfer_buffer, false);
+    memcpy(data, transforms->data, transforms->size * sizeof(GpuTransform));
+    SDL_UnmapGPUTransferBuffer(_APP.gpu, slot->transform_transfer_buffer);
+}
+
+// The clip table is rebuilt every frame, so clips still pushed get new
+// entries the next time something is drawn in them
+static void sdl_reset_clips() {
+    _APP.clip_store.size = 1;
+    for (int i = 0; i < _APP.clip_depth; i++) {
+        _APP.clip_stack[i].index = -1;
+    }
+    _APP.clip = _APP.clip_depth > 0 ? -1 : 0;
+}
+
+static void sdl_bind_quads(SDL_GPUBuffer *quads, SDL_GPUBuffer *order, FrameSlot *slot) {
+    // The order binding has to be filled even when it isn't read
+    SDL_GPUBuffer *storage[4] = {quads, order ? order : quads, slot->clip_buffer, slot->transform_buffer};
+    SDL_BindGPUVertexStorageBuffers(_APP.render_pass, 0, storage, 4);
+}
+
+static PipelineKind blended_pipeline(PipelineKind pipeline) {
+    if (pipeline == PIPELINE_SOLID_OPAQUE) {
+        return PIPELINE_SOLID;
+    }
+    if (pipeline == PIPELINE_SPRITE_OPAQUE) {
+        return PIPELINE_SPRITE;
+    }
+    return pipeline;
+}
+
+// Applies the benchmarking switches to the pipeline quads asked for
+static PipelineKind sdl_pipeline_for(PipelineKind pipeline) {
+    if (_APP.uber_only) {
+        return PIPELINE_UBER;
+    }
+    return _APP.no_opaque_pass ? blended_pipeline(pipeline) : pipeline;
+}
+
+static void push_draw(DrawStore *draws, Draw draw) {
+    if (draws->size == draws->capacity) {
+        draws->capacity *= 2;
+        draws->data = realloc(draws->data, draws->capacity * sizeof(Draw));
+    }
+    draws->data[draws->size] = draw;
+    draws->size++;
+}
+
+static void sdl_draw(Draw *draw, bool reverse) {
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    Batch *batch = draw->batch;
+
+    PipelineKind pipeline = sdl_pipeline_for(batch->pipeline);
+    SDL_GPUGraphicsPipeline *gpu_pipeline = sdl_get_pipeline((PipelineState){pipeline, batch->blend});
+    if (gpu_pipeline != _APP.bound_pipeline) {
+        SDL_BindGPUGraphicsPipeline(_APP.render_pass, gpu_pipeline);
+        _APP.bound_pipeline = gpu_pipeline;
+        _APP.stats.pipeline_switches++;
+    }
+
+    // Static batches bind their own buffer and frame batches their chunk's,
+    // so rebind only when that changes
+    QuadChunk *chunk = batch->source ? NULL : &slot->chunks[batch->first / QUAD_CHUNK_SIZE];
+    SDL_GPUBuffer *quads = batch->source ? batch->source->buffer : chunk->buffer;
+    SDL_GPUBuffer *order = batch->source ? NULL : chunk->order_buffer;
+    if (draw->gpu_culled) {
+        order = _APP.cull_visible_buffer;
+    }
+    if (quads != _APP.bound_quads || order != _APP.bound_order) {
+        sdl_bind_quads(quads, order, slot);
+        _APP.bound_quads = quads;
+        _APP.bound_order = order;
+    }
+
+    // Every slot the shader declares has to be bound, so unused ones get the
+    // blank rect texture. Solid and SDF shaders declare none.
+    if (pipeline_samples(pipeline)) {
+        SDL_GPUTextureSamplerBinding bindings[MAX_TEXTURE_SLOTS];
+        for (int i = 0; i < MAX_TEXTURE_SLOTS; i++) {
+            Texture *texture = i < batch->texture_count ? &batch->textures[i] : &_APP.rect_texture;
+            bindings[i] = (SDL_GPUTextureSamplerBinding){
+                .texture = texture->handle,
+                .sampler = _APP.sampler,
+            };
+        }
+        SDL_BindGPUFragmentSamplers(_APP.render_pass, 0, bindings, MAX_TEXTURE_SLOTS);
+    }
+
+    // first_vertex doesn't reliably offset SV_VertexID across backends,
+    // so the draw's start is passed to the shader instead. Only the GPU
+    // knows how many quads a GPU culled draw has, so the cull lists them
+    // backwards for the opaque pass, and their depth comes from where they
+    // are in the batch. Their indirect args are written for the
+    // non-instanced path.
+    bool instanced = !_APP.no_instancing && !draw->gpu_culled;
+    VertexUniforms uniforms = {
+        .screen_size = _APP.pass_size,
+        .quad_offset = draw->gpu_culled ? draw->visible_first : (u32)draw->first,
+        .use_order = draw->use_order || draw->gpu_culled,
+        .offset = batch->offset,
+        .clip_base = batch->clip_base,
+        .depth_offset = draw->depth,
+        .transform_base = batch->transform_base,
+        .quad_count = draw->count,
+        .reverse = reverse && !draw->gpu_culled,
+        .instanced = instanced,
+        .culled = draw->gpu_culled,
+        .source_first = draw->first,
+    };
+    SDL_PushGPUVertexUniformData(_APP.cmdbuf, 0, &uniforms, sizeof(uniforms));
+
+    if (draw->gpu_culled) {
+        SDL_DrawGPUPrimitivesIndirect(_APP.render_pass, _APP.cull_args_buffer, draw->args_offset, 1);
+    } else if (instanced) {
+        SDL_DrawGPUIndexedPrimitives(_APP.render_pass, 6, draw->count, 0, 0, 0);
+    } else {
+        SDL_DrawGPUPrimitives(_APP.render_pass, draw->count * 6, 1, 0, 0);
+    }
+    _APP.stats.draw_calls++;
+}
+
+// Opaque draws go first and front to back, so hidden pixels fail the depth
+// test before they are shaded. The rest follow in painter's order, tested
+// against them.
+static void sdl_draw_list(DrawStore *draws) {
+    _APP.bound_pipeline = NULL;
+    _APP.bound_quads = NULL;
+    _APP.bound_order = NULL;
+    SDL_BindGPUIndexBuffer(_APP.render_pass, &(SDL_GPUBufferBinding){_APP.quad_index_buffer, 0}, SDL_GPU_INDEXELEMENTSIZE_16BIT);
+    for (int i = draws->size - 1; i >= 0; i--) {
+        Batch *batch = draws->data[i].batch;
+        if (pipeline_is_opaque(sdl_pipeline_for(batch->pipeline))) {
+            sdl_draw(&draws->data[i], true);
+            _APP.stats.opaque_quads += draws->data[i].count;
+        }
+    }
+    for (int i = 0; i < draws->size; i++) {
+        Batch *batch = draws->data[i].batch;
+        if (!pipeline_is_opaque(sdl_pipeline_for(batch->pipeline))) {
+            sdl_draw(&draws->data[i], false);
+        }
+    }
+}
+
+// Culls the big static draws on the GPU. Their quads stay in the static
+// batch's buffer; the compute stages write the indices of the visible ones,
+// in order, to the visible list and their vertex count to the draw's
+// indirect args. Frame quads were culled on the CPU as they were drawn.
+// Downloads the culled draws' args and quads for sdl_finish_cull_check, which
+// runs when the slot comes round again
+static void sdl_record_cull_check(DrawStore *draws, FrameSlot *slot, u32 job_count, u32 quad_count) {
+    CullCheck *check = &slot->cull_check;
+    u32 size = job_count * sizeof(SDL_GPUIndirectDrawCommand) + quad_count * sizeof(GpuQuad);
+    if (check->download_size < size) {
+        if (check->download) {
+            SDL_ReleaseGPUTransferBuffer(_APP.gpu, check->download);
+        }
+        check->download_size = SDL_max(size, check->download_size * 2);
+        check->download = SDL_CreateGPUTransferBuffer(
+            _APP.gpu,
+            &(SDL_GPUTransferBufferCreateInfo){
+                .usage = SDL_GPU_TRANSFERBUFFERUSAGE_DOWNLOAD,
+                .size = check->download_size,
+            }
+        );
+        ASSERT_CREATED(check->download);
+    }
+    check->draws = realloc(check->draws, job_count * sizeof(CullCheckDraw));
+    check->clips = realloc(check->clips, _APP.clip_store.size * sizeof(Rect));
+    check->transforms = realloc(check->transforms, _APP.transform_store.size * sizeof(GpuTransform));
+    memcpy(check->clips, _APP.clip_store.data, _APP.clip_store.size * sizeof(Rect));
+    memcpy(check->transforms, _APP.transform_store.data, _APP.transform_store.size * sizeof(GpuTransform));
+
+    SDL_GPUCopyPass *copy_pass = SDL_BeginGPUCopyPass(_APP.cmdbuf);
+    u32 args_size = job_count * sizeof(SDL_GPUIndirectDrawCommand);
+    SDL_DownloadFromGPUBuffer(
+        copy_pass,
+        &(SDL_GPUBufferRegion){.buffer = _APP.cull_args_buffer, .offset = 0, .size = args_size},
+        &(SDL_GPUTransferBufferLocation){.transfer_buffer = check->download, .offset = 0}
+    );
+    u32 offset = args_size;
+    check->draw_count = 0;
+    for (int i = 0; i < draws->size; i++) {
+        Draw *draw = &draws->data[i];
+        if (!draw->gpu_culled) {
+            continue;
+        }
+        Batch *batch = draw->batch;
+        u32 quads_size = draw->count * sizeof(GpuQuad);
+        SDL_DownloadFromGPUBuffer(
+            copy_pass,
+            &(SDL_GPUBufferRegion){.buffer = batch->source->buffer, .offset = draw->first * sizeof(GpuQuad), .size = quads_size},
+            &(SDL_GPUTransferBufferLocation){.transfer_buffer = check->download, .offset = offset}
+        );
+        offset += quads_size;
+        check->draws[check->draw_count] = (CullCheckDraw){
+            .offset = batch->offset,
+            .quad_count = draw->count,
+            .clip_base = batch->clip_base,
+            .transform_base = batch->transform_base,
+        };
+        check->draw_count++;
+    }
+    SDL_EndGPUCopyPass(copy_pass);
+}
+
+static void sdl_gpu_cull(DrawStore *draws, FrameSlot *slot) {
+    u32 group_count = 0;
+    u32 visible_count = 0;
+    u32 job_count = 0;
+    for (int i = 0; i < draws->size; i++) {
+        Draw *draw = &draws->data[i];
+        u32 groups = (draw->count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE;
+        if (!draw->batch->source || draw->count < GPU_CULL_MIN_QUADS || groups > CULL_MAX_GROUPS) {
+            continue;
+        }
+        draw->gpu_culled = true;
+        draw->cull_group_first = group_count;
+        draw->visible_first = visible_count;
+        draw->args_offset = job_count * sizeof(SDL_GPUIndirectDrawCommand);
+        group_count += groups;
+        visible_count += draw->count;
+        job_count++;
+    }
+    if (job_count == 0) {
+        return;
+    }
+
+    sdl_reserve_gpu_buffer(&_APP.cull_groups_buffer, &_APP.cull_groups_size, group_count * sizeof(u32),
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ | SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE);
+    sdl_reserve_gpu_buffer(&_APP.cull_visible_buffer, &_APP.cull_visible_size, visible_count * sizeof(u32),
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE | SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ);
+    sdl_reserve_gpu_buffer(&_APP.cull_args_buffer, &_APP.cull_args_size, job_count * sizeof(SDL_GPUIndirectDrawCommand),
+        SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_WRITE | SDL_GPU_BUFFERUSAGE_INDIRECT);
+
+    // Each stage reads what the one before wrote, which takes a pass
+    // boundary. Only the first cycles, so the later ones see its buffers.
+    for (u32 stage = 0; stage < 3; stage++) {
+        SDL_GPUStorageBufferReadWriteBinding bindings[3] = {
+            {.buffer = _APP.cull_groups_buffer, .cycle = stage == 0},
+            {.buffer = _APP.cull_visible_buffer, .cycle = stage == 0},
+            {.buffer = _APP.cull_args_buffer, .cycle = stage == 0},
+        };
+        SDL_GPUComputePass *pass = SDL_BeginGPUComputePass(_APP.cmdbuf, NULL, 0, bindings, 3);
+        SDL_BindGPUComputePipeline(pass, _APP.cull_pipeline);
+
+        SDL_GPUBuffer *bound = NULL;
+        for (int i = 0; i < draws->size; i++) {
+            Draw *draw = &draws->data[i];
+            if (!draw->gpu_culled) {
+                continue;
+            }
+            Batch *batch = draw->batch;
+            if (batch->source->buffer != bound) {
+                SDL_GPUBuffer *storage[3] = {batch->source->buffer, slot->clip_buffer, slot->transform_buffer};
+                SDL_BindGPUComputeStorageBuffers(pass, 0, storage, 3);
+                bound = batch->source->buffer;
+            }
+
+            // The opaque pass draws front to back, so its visible lists are
+            // written in reverse
+            CullUniforms uniforms = {
+                .offset = batch->offset,
+                .quad_first = draw->first,
+                .quad_count = draw->count,
+                .group_first = draw->cull_group_first,
+                .visible_first = draw->visible_first,
+                .args_first = draw->args_offset / sizeof(u32),
+                .clip_base = batch->clip_base,
+                .stage = stage,
+                .transform_base = batch->transform_base,
+                .reverse = pipeline_is_opaque(sdl_pipeline_for(batch->pipeline)),
+            };
+            SDL_PushGPUComputeUniformData(_APP.cmdbuf, 0, &uniforms, sizeof(uniforms));
+            SDL_DispatchGPUCompute(pass, stage == 1 ? 1 : (draw->count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+        }
+        SDL_EndGPUComputePass(pass);
+    }
+    _APP.stats.gpu_culled_draws = job_count;
+
+    if (_APP.gpu_cull_check) {
+        sdl_record_cull_check(draws, slot, job_count, visible_count);
+    }
+}
+
+// Renders a layer's recorded content into its texture. The content was drawn
+// in screen coordinates, so it is moved to the texture's origin.
+static void sdl_render_cached_layer(CachedLayer *layer) {
+    StaticBatch *sb = layer->content;
+    _APP.render_pass = SDL_BeginGPURenderPass(
+        _APP.cmdbuf,
+        &(SDL_GPUColorTargetInfo){
+            .texture = layer->texture.handle,
+            .cycle = true,
+            .load_op = SDL_GPU_LOADOP_CLEAR,
+            .store_op = SDL_GPU_STOREOP_STORE,
+            .clear_color = (SDL_FColor){0.0f, 0.0f, 0.0f, 0.0f},
+        },
+        1,
+        &(SDL_GPUDepthStencilTargetInfo){
+            .texture = layer->depth_texture,
+            .clear_depth = 1.0f,
+            .load_op = SDL_GPU_LOADOP_CLEAR,
+            .store_op = SDL_GPU_STOREOP_DONT_CARE,
+            .stencil_load_op = SDL_GPU_LOADOP_DONT_CARE,
+            .stencil_store_op = SDL_GPU_STOREOP_DONT_CARE,
+            .cycle = true,
+        }
+    );
+    _APP.stats.render_passes++;
+
+    DrawStore *draws = &_APP.draw_store;
+    draws->size = 0;
+    u32 depth = 0;
+    for (int i = 0; i < sb->batches.size; i++) {
+        Batch *batch = &sb->batches.data[i];
+        batch->source = sb;
+        batch->offset = (Vec2){-layer->rect.x, -layer->rect.y};
+        batch->clip_base = layer->clip;
+        batch->transform_base = layer->transform_base;
+        push_draw(draws, (Draw){.batch = batch, .first = batch->first, .count = batch->count, .depth = depth});
+        depth += batch->count;
+    }
+    _APP.pass_size = (Vec2){layer->rect.w, layer->rect.h};
+    sdl_draw_list(draws);
+    _APP.stats.quads += depth;
+
+    SDL_EndGPURenderPass(_APP.render_pass);
+}
+
+// Starts the next frame's lists. The display list just built becomes the
+// one the next frame is compared against.
+static void sdl_reset_frame() {
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    for (int i = 0; i < slot->chunk_count; i++) {
+        QuadChunk *chunk = &slot->chunks[i];
+        if (chunk->quads) {
+            SDL_UnmapGPUTransferBuffer(_APP.gpu, chunk->transfer_buffer);
+            chunk->quads = NULL;
+        }
+        chunk->idle_frames = chunk->quad_count > 0 ? 0 : chunk->idle_frames + 1;
+        chunk->quad_count = 0;
+    }
+    slot->quad_count = 0;
+
+    // Chunks are filled in order, so those a spike added are at the end
+    while (slot->chunk_count > 1 && slot->chunks[slot->chunk_count - 1].idle_frames > QUAD_CHUNK_IDLE_FRAMES) {
+        slot->chunk_count--;
+        sdl_release_quad_chunk(&slot->chunks[slot->chunk_count]);
+    }
+    _APP.batch_store.size = 0;
+    _APP.run_store.size = 0;
+    _APP.run_store.sorted = true;
+    _APP.should_clear = false;
+    _APP.untracked_frame = false;
+    _APP.display_list = !_APP.display_list;
+    _APP.display_lists[_APP.display_list].size = 0;
+    sdl_reset_clips();
+    _APP.transform_store.size = 1;
+    _APP.transform_index = _APP.transformed ? -1 : 0;
+}
+
+// Items are compared by position in the list. An inserted or removed item
+// damages everything after it, which is conservative but never wrong.
+static Rect sdl_diff_display_lists(DisplayList *items, DisplayList *last_items) {
+    Rect damage = {0};
+    int common = SDL_min(items->size, last_items->size);
+    for (int i = 0; i < common; i++) {
+        if (items->data[i].hash != last_items->data[i].hash) {
+            damage = rect_union(damage, items->data[i].rect);
+            damage = rect_union(damage, last_items->data[i].rect);
+        }
+    }
+    for (int i = common; i < items->size; i++) {
+        damage = rect_union(damage, items->data[i].rect);
+    }
+    for (int i = common; i < last_items->size; i++) {
+        damage = rect_union(damage, last_items->data[i].rect);
+    }
+
+    if (damage.w <= 0.0f || damage.h <= 0.0f) {
+        return damage;
+    }
+
+    // Pad for edge antialiasing and keep it on screen
+    damage = (Rect){damage.x - 1.0f, damage.y - 1.0f, damage.w + 2.0f, damage.h + 2.0f};
+    return rect_intersection(damage, (Rect){0, 0, _APP.screen_size.x, _APP.screen_size.y});
+}
+
+static void sdl_blit_canvas(SDL_GPUCommandBuffer *cmdbuf, SDL_GPUTexture *swapchain_texture, u32 swapchain_w, u32 swapchain_h, u32 render_w, u32 render_h) {
+    SDL_BlitGPUTexture(
+        cmdbuf,
+        &(SDL_GPUBlitInfo){
+            .source = {
+                .texture = _APP.canvas,
+                .w = render_w,
+                .h = render_h,
+            },
+            .destination = {
+                .texture = swapchain_texture,
+                .w = swapchain_w,
+                .h = swapchain_h,
+            },
+            .load_op = SDL_GPU_LOADOP_DONT_CARE,
+            .filter = render_w == swapchain_w && render_h == swapchain_h ? SDL_GPU_FILTER_NEAREST : SDL_GPU_FILTER_LINEAR,
+        }
+    );
+}
+
+void sdl_flush() {
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    BatchStore *batches = &_APP.batch_store;
+    RunStore *runs = &_APP.run_store;
+
+    _APP.stats = (RenderStats){0};
+    _APP.stats.merged_batches = _APP.merged_batches;
+    _APP.stats.culled_quads = _APP.culled_quads;
+    _APP.stats.gpu_cull_mismatches = _APP.cull_mismatches;
+    _APP.cull_mismatches = 0;
+    f32 screen_area = _APP.screen_size.x * _APP.screen_size.y;
+    _APP.stats.overdraw = _APP.drawn_area / screen_area;
+    _APP.stats.blended_overdraw = (_APP.drawn_area - _APP.opaque_area) / screen_area;
+    _APP.merged_batches = 0;
+    _APP.culled_quads = 0;
+    _APP.drawn_area = 0.0f;
+    _APP.opaque_area = 0.0f;
+
+    // Frames that don't start with an opaque clear build on whatever was on
+    // screen, so they are always drawn in full. The same goes for frames with
+    // quads from draw_reserve_quads, whose contents aren't tracked.
+    DisplayList *items = &_APP.display_lists[_APP.display_list];
+    DisplayList *last_items = &_APP.display_lists[!_APP.display_list];
+    bool describes_frame = _APP.should_clear && _APP.clear_color.a >= 1.0f && !_APP.untracked_frame;
+    bool tracked = describes_frame && _APP.canvas_valid && _APP.canvas_scale == _APP.render_scale &&
+        SDL_memcmp(&_APP.clear_color, &_APP.last_clear_color, sizeof(Color)) == 0;
+    Rect damage = {0, 0, _APP.screen_size.x, _APP.screen_size.y};
+    if (tracked) {
+        damage = sdl_diff_display_lists(items, last_items);
+    }
+
+    // Layers recorded this frame have to be rendered even if nothing on
+    // screen changed, or their textures would be left empty
+    bool layers_pending = false;
+    for (int i = 0; i < _APP.cached_layers.size; i++) {
+        layers_pending |= _APP.cached_layers.data[i].content != NULL;
+    }
+
+    bool skip = batches->size == 0 && !_APP.should_clear;
+    if (tracked && (damage.w <= 0.0f || damage.h <= 0.0f)) {
+        skip = true;
+    }
+    skip &= !layers_pending;
+    if (skip) {
+        _APP.stats.skipped = true;
+        sdl_reset_frame();
+        return;
+    }
+    _APP.stats.damage = damage;
+    _APP.stats.render_scale = _APP.render_scale;
+
+    // Damage is redrawn over the previous frame in the canvas. The swapchain
+    // can't be used for this: its images rotate, so the one acquired holds a
+    // frame from further back than the last one.
+    bool partial = tracked && (damage.x > 0.0f || damage.y > 0.0f || damage.w < _APP.screen_size.x || damage.h < _APP.screen_size.y);
+    Batch clear_batch = {.pipeline = PIPELINE_SOLID_OPAQUE};
+    if (partial) {
+        // The clear becomes a quad over the damage, drawn first from one past
+        // the frame's quads
+        u32 packed = pack_color(_APP.clear_color);
+        clear_batch.first = sdl_chunk_fit(slot->quad_count, 1);
+        clear_batch.count = 1;
+        *sdl_reserve_frame_quads(slot, clear_batch.first, 1) = (GpuQuad){
+            .dst_rect = damage,
+            .color = packed,
+            .border_color = packed,
+        };
+    }
+    for (int i = 0; i < slot->chunk_count; i++) {
+        QuadChunk *chunk = &slot->chunks[i];
+        if (chunk->quads) {
+            SDL_UnmapGPUTransferBuffer(_APP.gpu, chunk->transfer_buffer);
+            chunk->quads = NULL;
+        }
+    }
+    _APP.stats.quad_chunks = slot->chunk_count;
+
+    _APP.cmdbuf = SDL_AcquireGPUCommandBuffer(_APP.gpu);
+    ASSERT_CREATED(_APP.cmdbuf);
+    // Waiting for a swapchain texture, rather than dropping the frame when
+    // none is free, is what paces drawn frames to the display. SDL only
+    // allows it on the thread that created the window.
+    u32 swapchain_w = 0, swapchain_h = 0;
+    ASSERT_CALL(SDL_WaitAndAcquireGPUSwapchainTexture(_APP.cmdbuf, _APP.window, &_APP.swapchain_texture, &swapchain_w, &swapchain_h));
+
+    // Layers drawn out of order need an index list that puts the quads
+    // back in layer order. Otherwise batches are drawn straight from the
+    // quad buffer.
+    bool use_order = !runs->sorted;
+    if (use_order) {
+        radix_sort_runs(runs);
+        sdl_write_quad_order(slot, runs, batches);
+    }
+#ifdef CHECK_QUAD_RUNS
+    SDL_assert(use_order || runs_are_batch_ranges(runs, batches));
+#endif
+
+    // One upload per chunk for everything drawn this frame. The quads were
+    // written straight into the transfer buffers; the slot's fence was waited
+    // on in sdl_begin_frame, so there is no need to let the driver cycle.
+    // Static batches are already on the GPU.
+    if (batches->size > 0 || partial || layers_pending) {
+        SDL_GPUCopyPass *copy_pass = SDL_BeginGPUCopyPass(_APP.cmdbuf);
+        for (int i = 0; i < slot->chunk_count; i++) {
+            QuadChunk *chunk = &slot->chunks[i];
+            if (chunk->quad_count > 0) {
+                SDL_UploadToGPUBuffer(
+                        copy_pass,
+                        &(SDL_GPUTransferBufferLocation) {
+                        .transfer_buffer = chunk->transfer_buffer,
+                        .offset = 0,
+                        },
+                        &(SDL_GPUBufferRegion) {
+                        .buffer = chunk->buffer,
+                        .offset = 0,
+                        .size = chunk->quad_count * sizeof(GpuQuad),
+                        },
+                        false
+                        );
+                _APP.stats.upload_bytes += chunk->quad_count * sizeof(GpuQuad);
+            }
+
+            if (use_order && chunk->order_count > 0) {
+                SDL_UploadToGPUBuffer(
+                        copy_pass,
+                        &(SDL_GPUTransferBufferLocation) {
+                        .transfer_buffer = chunk->order_transfer_buffer,
+                        .offset = 0,
+                        },
+                        &(SDL_GPUBufferRegion) {
+                        .buffer = chunk->order_buffer,
+                        .offset = 0,
+                        .size = chunk->order_count * sizeof(u32),
+                        },
+                        false
+                        );
+                _APP.stats.upload_bytes += chunk->order_count * sizeof(u32);
+            }
+        }
+
+        sdl_write_clip_table(slot, &_APP.clip_store);
+        SDL_UploadToGPUBuffer(
+                copy_pass,
+                &(SDL_GPUTransferBufferLocation) {
+                .transfer_buffer = slot->clip_transfer_buffer,
+                .offset = 0,
+                },
+                &(SDL_GPUBufferRegion) {
+                .buffer = slot->clip_buffer,
+                .offset = 0,
+                .size = _APP.clip_store.size * sizeof(Rect),
+                },
+                false
+                );
+        _APP.stats.upload_bytes += _APP.clip_store.size * sizeof(Rect);
+
+        sdl_write_transform_table(slot, &_APP.transform_store);
+        SDL_UploadToGPUBuffer(
+                copy_pass,
+                &(SDL_GPUTransferBufferLocation) {
+                .transfer_buffer = slot->transform_transfer_buffer,
+                .offset = 0,
+                },
+                &(SDL_GPUBufferRegion) {
+                .buffer = slot->transform_buffer,
+                .offset = 0,
+                .size = _APP.transform_store.size * sizeof(GpuTransform),
+                },
+                false
+                );
+        _APP.stats.upload_bytes += _APP.transform_store.size * sizeof(GpuTransform);
+        SDL_EndGPUCopyPass(copy_pass);
+    }
+
+    for (int i = 0; i < _APP.cached_layers.size; i++) {
+        CachedLayer *layer = &_APP.cached_layers.data[i];
+        if (layer->content && layer->content->quad_count > 0) {
+            sdl_render_cached_layer(layer);
+        } else if (layer->content) {
+            // Nothing to draw, but the texture still needs clearing
+            SDL_EndGPURenderPass(SDL_BeginGPURenderPass(
+                _APP.cmdbuf,
+                &(SDL_GPUColorTargetInfo){
+                    .texture = layer->texture.handle,
+                    .cycle = true,
+                    .load_op = SDL_GPU_LOADOP_CLEAR,
+                    .store_op = SDL_GPU_STOREOP_STORE,
+                },
+                1,
+                NULL
+            ));
+        }
+    }
+
+    // Lay the frame out as draws in painter's order, numbering quads as they
+    // go so later ones sit in front
+    DrawStore *draws = &_APP.draw_store;
+    draws->size = 0;
+    u32 depth = 0;
+
+    // The partial clear is an opaque quad behind everything else. Draws
+    // index their chunk, or its order buffer.
+    if (partial) {
+        push_draw(draws, (Draw){.batch = &clear_batch, .first = clear_batch.first % QUAD_CHUNK_SIZE, .count = 1, .depth = depth});
+        depth++;
+    }
+
+    for (int i = 0; i < slot->chunk_count; i++) {
+        slot->chunks[i].order_next = 0;
+    }
+    for (int i = 0; i < (use_order ? runs->size : batches->size);) {
+        Batch *batch;
+        int count = 0;
+        if (use_order) {
+            // Consecutive sorted runs from the same batch share a draw
+            u32 batch_index = runs->data[i].key & RUN_KEY_BATCH_MASK;
+            batch = &batches->data[batch_index];
+            for (; i < runs->size && (runs->data[i].key & RUN_KEY_BATCH_MASK) == batch_index; i++) {
+                count += runs->data[i].count;
+            }
+        } else {
+            batch = &batches->data[i];
+            count = batch->count;
+            i++;
+        }
+
+        if (batch->source) {
+            push_draw(draws, (Draw){.batch = batch, .first = batch->first, .count = batch->count, .depth = depth});
+        } else if (use_order) {
+            QuadChunk *chunk = &slot->chunks[batch->first / QUAD_CHUNK_SIZE];
+            push_draw(draws, (Draw){.batch = batch, .first = chunk->order_next, .count = count, .depth = depth, .use_order = true});
+            chunk->order_next += count;
+        } else {
+            push_draw(draws, (Draw){.batch = batch, .first = batch->first % QUAD_CHUNK_SIZE, .count = count, .depth = depth});
+        }
+        depth += count;
+    }
+
+    if (_APP.gpu_culling) {
+        sdl_gpu_cull(draws, slot);
+    }
+
+    // One render pass, one draw per batch
+    _APP.render_pass = SDL_BeginGPURenderPass(
+        _APP.cmdbuf,
+        &(SDL_GPUColorTargetInfo){
+            .texture = _APP.canvas,
+            .cycle = false,
+            .load_op = _APP.should_clear && !partial ? SDL_GPU_LOADOP_CLEAR : SDL_GPU_LOADOP_LOAD,
+            .store_op = SDL_GPU_STOREOP_STORE,
+            .clear_color = (SDL_FColor){_APP.clear_color.r, _APP.clear_color.g, _APP.clear_color.b, _APP.clear_color.a},
+        },
+        1,
+        &(SDL_GPUDepthStencilTargetInfo){
+            .texture = _APP.depth_texture,
+            .clear_depth = 1.0f,
+            .load_op = SDL_GPU_LOADOP_CLEAR,
+            .store_op = SDL_GPU_STOREOP_DONT_CARE,
+            .stencil_load_op = SDL_GPU_LOADOP_DONT_CARE,
+            .stencil_store_op = SDL_GPU_STOREOP_DONT_CARE,
+            .cycle = true,
+        }
+    );
+    _APP.stats.render_passes++;
+
+    u32 render_w = SDL_max(1, (u32)(_APP.canvas_size.x * _APP.render_scale));
+    u32 render_h = SDL_max(1, (u32)(_APP.canvas_size.y * _APP.render_scale));
+    SDL_SetGPUViewport(_APP.render_pass, &(SDL_GPUViewport){0, 0, render_w, render_h, 0.0f, 1.0f});
+
+    if (partial) {
+        f32 scale_x = render_w / _APP.screen_size.x;
+        f32 scale_y = render_h / _APP.screen_size.y;
+        int x0 = (int)SDL_floorf(damage.x * scale_x);
+        int y0 = (int)SDL_floorf(damage.y * scale_y);
+        int x1 = (int)SDL_ceilf((damage.x + damage.w) * scale_x);
+        int y1 = (int)SDL_ceilf((damage.y + damage.h) * scale_y);
+        SDL_SetGPUScissor(_APP.render_pass, &(SDL_Rect){x0, y0, x1 - x0, y1 - y0});
+    }
+
+    _APP.pass_size = _APP.screen_size;
+    sdl_draw_list(draws);
+    _APP.stats.quads += depth - partial;
+    _APP.stats.opaque_quads -= partial;
+
+    SDL_EndGPURenderPass(_APP.render_pass);
+
+    if (_APP.swapchain_texture) {
+        sdl_blit_canvas(_APP.cmdbuf, _APP.swapchain_texture, swapchain_w, swapchain_h, render_w, render_h);
+    }
+
+    // The next frame can only be diffed against this one if its display list
+    // fully describes the canvas and it made it to the screen
+    _APP.canvas_valid = describes_frame && _APP.swapchain_texture;
+    _APP.canvas_scale = _APP.render_scale;
+    _APP.last_clear_color = _APP.clear_color;
+
+    sdl_reset_frame();
+}
+
+static void sdl_handle_event(SDL_Event *e) {
+    switch (e->type) {
+        case SDL_EVENT_QUIT:
+            {
+                _APP.should_quit = true;
+            }
+            break;
+
+        // Unchanged frames aren't presented, so whatever the window shows
+        // after one of these could be stale. Drawing the next frame in full
+        // presents it again.
+        case SDL_EVENT_WINDOW_EXPOSED:
+        case SDL_EVENT_WINDOW_SHOWN:
+        case SDL_EVENT_WINDOW_RESTORED:
+        case SDL_EVENT_WINDOW_RESIZED:
+        case SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED:
+            {
+                _APP.canvas_valid = false;
+            }
+            break;
+
+        case SDL_EVENT_MOUSE_BUTTON_DOWN:
+            {
+
+                Button button = BUTTON_INVALID;
+                switch (e->button.button) {
+                    case SDL_BUTTON_LEFT: button = BUTTON_LEFT; break;
+                    case SDL_BUTTON_RIGHT: button = BUTTON_RIGHT; break;
+                    case SDL_BUTTON_MIDDLE: button = BUTTON_MIDDLE; break;
                 }
-                break;
+                _APP.input.buttons_down[button] = true;
+                _APP.input.buttons_pressed[button] = true;
+            }
+            break;
+        case SDL_EVENT_MOUSE_BUTTON_UP:
+            {
+                Button button = BUTTON_INVALID;
+                switch (e->button.button) {
+                    case SDL_BUTTON_LEFT: button = BUTTON_LEFT; break;
+                    case SDL_BUTTON_RIGHT: button = BUTTON_RIGHT; break;
+                    case SDL_BUTTON_MIDDLE: button = BUTTON_MIDDLE; break;
+                }
+                _APP.input.buttons_down[button] = false;
+                _APP.input.buttons_released[button] = true;
+            }
+            break;
+        case SDL_EVENT_KEY_DOWN:
+            {
+                Key key = _APP.input.keymap[e->key.scancode];
+                _APP.input.keys_down[key] = true;
+                _APP.input.keys_pressed[key] = true;
+            }
+            break;
+        case SDL_EVENT_MOUSE_MOTION:
+            {
+                _APP.input.mouse.x = (f32)e->motion.x;
+                _APP.input.mouse.y = (f32)e->motion.y;
+            }
+            break;
+        case SDL_EVENT_MOUSE_WHEEL:
+            {
+                _APP.input.wheel.x = (f32)e->wheel.x;
+                _APP.input.wheel.y = (f32)e->wheel.y;
+            }
+            break;
+        case SDL_EVENT_KEY_UP:
+            {
+                Key key = _APP.input.keymap[e->key.scancode];
+                _APP.input.keys_down[key] = false;
+                _APP.input.keys_released[key] = true;
+            }
+            break;
+        case SDL_EVENT_TEXT_INPUT:
+            {
+                int i = 0;
+                while (e->text.text[i] && i < TEXT_BUF_LEN) {
+                    _APP.input.textbuf[i] = e->text.text[i];
+                    i++;
+                }
+            }
+            break;
+    }
+}
+
+void sdl_process_events() {
+    SDL_Event e;
+
+    _APP.input.textbuf_pos = 0;
+    for (int i = 0; i < KEY_COUNT; i++) {
+        _APP.input.keys_pressed[i] = false;
+        _APP.input.keys_released[i] = false;
+    }
+    for (int i = 0; i < TEXT_BUF_LEN; i++) {
+        _APP.input.textbuf[i] = '\0';
+    }
+    for (int i = 0; i < BUTTON_COUNT; i++) {
+        _APP.input.buttons_pressed[i] = false;
+        _APP.input.buttons_released[i] = false;
+    }
+
+    // In idle mode, sleep until there is input, a redraw request or the next
+    // timed redraw. Whatever woke us is handled along with anything queued.
+    if (_APP.idle_mode && !_APP.should_quit) {
+        Sint32 timeout = -1;
+        if (_APP.redraw_deadline) {
+            u64 now = SDL_GetTicks();
+            timeout = now >= _APP.redraw_deadline ? 0 : (Sint32)(_APP.redraw_deadline - now);
+        }
+        if (SDL_WaitEventTimeout(&e, timeout)) {
+            sdl_handle_event(&e);
+        }
+        if (_APP.redraw_deadline && SDL_GetTicks() >= _APP.redraw_deadline) {
+            _APP.redraw_deadline = 0;
+        }
+    }
+
+    while (SDL_PollEvent(&e)) {
+        sdl_handle_event(&e);
+    }
+
+}
+
+// Moves the render scale toward holding the frame time target. Fill cost
+// goes with the pixel count, the square of the scale, so a slow frame
+// scales down by the square root of how far over it is. Under vsync the
+// frame time can't drop below the refresh interval, so while it is on
+// target the scale creeps back up until it isn't.
+static void sdl_update_render_scale(f32 frame_ms) {
+    _APP.frame_time_average += (frame_ms - _APP.frame_time_average) * 0.1f;
+    if (_APP.render_scale_cooldown > 0) {
+        _APP.render_scale_cooldown--;
+        return;
+    }
+
+    f32 target = _APP.frame_time_target;
+    f32 scale = _APP.render_scale;
+    if (_APP.frame_time_average > target * 1.1f) {
+        scale *= SDL_max(0.75f, SDL_sqrtf(target / _APP.frame_time_average));
+    } else if (_APP.frame_time_average < target * 1.05f) {
+        scale += 0.05f;
+    }
+    scale = SDL_clamp(scale, MIN_RENDER_SCALE, 1.0f);
+
+    if (scale != _APP.render_scale) {
+        _APP.render_scale = scale;
+        _APP.render_scale_cooldown = RENDER_SCALE_COOLDOWN;
+    }
+}
+
+bool app_should_quit() {
+    sdl_flush();
+    sdl_end_frame();
+
+    // Frame time runs from before the fence wait to the submit, so waiting
+    // for events or pacing skipped frames doesn't count
+    u64 now = SDL_GetTicksNS();
+    if (_APP.frame_time_target > 0.0f && _APP.frame_start_ns && !_APP.stats.skipped) {
+        sdl_update_render_scale((now - _APP.frame_start_ns) / 1e6f);
+    }
+
+    // Skipped frames don't wait on the swapchain, so pace the loop instead.
+    // In idle mode the event wait does that.
+    if (_APP.stats.skipped && !_APP.idle_mode) {
+        SDL_Delay(_APP.frame_interval_ms);
+    }
+
+    sdl_process_events();
+
+    _APP.frame_start_ns = SDL_GetTicksNS();
+    sdl_begin_frame();
+    return _APP.should_quit;
+}
+
+void set_render_scale(f32 scale) {
+    _APP.render_scale = SDL_clamp(scale, MIN_RENDER_SCALE, 1.0f);
+}
+
+void set_frame_time_target(f32 ms) {
+    _APP.frame_time_target = ms;
+    _APP.frame_time_average = ms;
+    _APP.render_scale_cooldown = 0;
+}
+
+void set_idle_mode(bool enabled) {
+    _APP.idle_mode = enabled;
+}
+
+void request_redraw() {
+    // An event rather than a flag, so it also wakes the wait when called
+    // from another thread
+    SDL_PushEvent(&(SDL_Event){.type = _APP.redraw_event});
+}
+
+void request_redraw_after(u32 ms) {
+    u64 deadline = SDL_GetTicks() + ms;
+    if (!_APP.redraw_deadline || deadline < _APP.redraw_deadline) {
+        _APP.redraw_deadline = deadline;
+    }
+}
+
+Vec2 get_screen_size() {
+    return _APP.screen_size;
+}
+
+RenderStats get_render_stats() {
+    RenderStats stats = _APP.stats;
+    stats.pipelines = _APP.pipeline_cache.size;
+    return stats;
+}
+
+void app_clear(Color color) {
+    // Clearing is folded into the frame's render pass as its load op. Anything
+    // drawn before the clear would be overwritten, so drop it.
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    slot->quad_count = 0;
+    for (int i = 0; i < slot->chunk_count; i++) {
+        slot->chunks[i].quad_count = 0;
+    }
+    _APP.batch_store.size = 0;
+    _APP.run_store.size = 0;
+    _APP.run_store.sorted = true;
+    _APP.display_lists[_APP.display_list].size = 0;
+    _APP.untracked_frame = false;
+    _APP.should_clear = true;
+    _APP.clear_color = color;
+}
+
+// Returns the slot of texture in the batch, adding it if there is room, or -1
+// if the batch's slot table is full.
+static int batch_texture_slot(Batch *batch, Texture *texture) {
+    for (int slot = 0; slot < batch->texture_count; slot++) {
+        if (batch->textures[slot].idx == texture->idx) {
+            return slot;
+        }
+    }
+    if (batch->texture_count == MAX_TEXTURE_SLOTS) {
+        return -1;
+    }
+    batch->textures[batch->texture_count] = *texture;
+    return batch->texture_count++;
+}
+
+void push_layer(int layer) {
+    if (_APP.layer_depth < LAYER_STACK_SIZE) {
+        _APP.layer_stack[_APP.layer_depth] = _APP.layer;
+        _APP.layer_depth++;
+    }
+    _APP.layer = SDL_clamp(layer, 0, 255);
+}
+
+void pop_layer() {
+    if (_APP.layer_depth > 0) {
+        _APP.layer_depth--;
+        _APP.layer = _APP.layer_stack[_APP.layer_depth];
+    }
+}
+
+void push_blend_mode(BlendMode blend) {
+    if (_APP.blend_depth < BLEND_STACK_SIZE) {
+        _APP.blend_stack[_APP.blend_depth] = _APP.blend;
+        _APP.blend_depth++;
+    }
+    _APP.blend = blend;
+}
+
+void pop_blend_mode() {
+    if (_APP.blend_depth > 0) {
+        _APP.blend_depth--;
+        _APP.blend = _APP.blend_stack[_APP.blend_depth];
+    }
+}
+
+// Draw lists may be built on other threads, which don't see the blend stack
+static BlendMode current_blend() {
+    return _draw_list ? BLEND_ALPHA : _APP.blend;
+}
+
+static u32 blend_flags(BlendMode blend) {
+    return blend == BLEND_MULTIPLY ? QUAD_PREMULTIPLY : 0;
+}
+
+// Adds t to transforms, returning its index, or 0 (the identity) once there
+// are more than a quad's transform field can index.
+static u16 add_transform(TransformStore *transforms, GpuTransform t) {
+    if (transforms->size >= MAX_TRANSFORMS) {
+        return 0;
+    }
+    if (transforms->size == transforms->capacity) {
+        transforms->capacity *= 2;
+        transforms->data = realloc(transforms->data, transforms->capacity * sizeof(GpuTransform));
+    }
+    transforms->data[transforms->size] = t;
+    transforms->size++;
+    return transforms->size - 1;
+}
+
+// m around pivot, then moved by offset: p maps to m (p - pivot) + pivot + offset
+static GpuTransform make_transform(Mat2 m, Vec2 pivot, Vec2 offset) {
+    return (GpuTransform){
+        .m = m,
+        .t = {
+            .x = pivot.x - m.columns[0].x * pivot.x - m.columns[1].x * pivot.y + offset.x,
+            .y = pivot.y - m.columns[0].y * pivot.x - m.columns[1].y * pivot.y + offset.y,
+        },
+    };
+}
+
+static Vec2 transform_point(GpuTransform t, Vec2 p) {
+    return (Vec2){
+        .x = t.m.columns[0].x * p.x + t.m.columns[1].x * p.y + t.t.x,
+        .y = t.m.columns[0].y * p.x + t.m.columns[1].y * p.y + t.t.y,
+    };
+}
+
+// b, then a
+static GpuTransform compose_transforms(GpuTransform a, GpuTransform b) {
+    Vec2 t = transform_point(a, b.t);
+    return (GpuTransform){.m = mul_m2(a.m, b.m), .t = t};
+}
+
+static f32 transform_determinant(GpuTransform t) {
+    return t.m.columns[0].x * t.m.columns[1].y - t.m.columns[1].x * t.m.columns[0].y;
+}
+
+// Only for transforms with a nonzero determinant
+static GpuTransform invert_transform(GpuTransform t) {
+    GpuTransform inverse = {.m = invgeneral_m2(t.m)};
+    Vec2 moved = transform_point(inverse, t.t);
+    inverse.t = (Vec2){.x = -moved.x, .y = -moved.y};
+    return inverse;
+}
+
+static bool transform_is_identity(GpuTransform t) {
+    return t.m.columns[0].x == 1.0f && t.m.columns[0].y == 0.0f && t.m.columns[1].x == 0.0f &&
+        t.m.columns[1].y == 1.0f && t.t.x == 0.0f && t.t.y == 0.0f;
+}
+
+// Bounds of rect after t
+static Rect transform_rect_bounds(GpuTransform t, Rect rect) {
+    Vec2 corners[4] = {
+        {.x = rect.x, .y = rect.y},
+        {.x = rect.x + rect.w, .y = rect.y},
+        {.x = rect.x, .y = rect.y + rect.h},
+        {.x = rect.x + rect.w, .y = rect.y + rect.h},
+    };
+    f32 x0 = 1e30f, y0 = 1e30f, x1 = -1e30f, y1 = -1e30f;
+    for (int i = 0; i < 4; i++) {
+        Vec2 p = transform_point(t, corners[i]);
+        x0 = SDL_min(x0, p.x);
+        y0 = SDL_min(y0, p.y);
+        x1 = SDL_max(x1, p.x);
+        y1 = SDL_max(y1, p.y);
+    }
+    return (Rect){x0, y0, x1 - x0, y1 - y0};
+}
+
+// Whether quads drawn now go through the camera and transform stack. Static
+// batches, cached layers and draw lists record in their own space and take
+// the transform they are drawn under.
+static bool sdl_transformed() {
+    return !_draw_list && !_APP.recording && _APP.transformed;
+}
+
+// Screen bounds of something drawn now with the given bounds
+static Rect sdl_screen_bounds(Rect bounds) {
+    return sdl_transformed() ? transform_rect_bounds(_APP.transform, bounds) : bounds;
+}
+
+// Index of the current transform in the frame's table, for frame quads
+static u16 current_transform_index() {
+    if (!sdl_transformed()) {
+        return 0;
+    }
+    if (_APP.transform_index < 0) {
+        _APP.transform_index = add_transform(&_APP.transform_store, _APP.transform);
+    }
+    return _APP.transform_index;
+}
+
+static void sdl_update_transform() {
+    _APP.transform = compose_transforms(_APP.camera, _APP.local_transform);
+    _APP.transformed = !transform_is_identity(_APP.transform);
+    _APP.transform_index = _APP.transformed ? -1 : 0;
+    bool invertible = transform_determinant(_APP.transform) != 0.0f;
+    _APP.inverse_transform = invertible ? invert_transform(_APP.transform) : (GpuTransform){0};
+}
+
+// Appends the transforms a static batch, draw list or cached layer recorded
+// to the frame's and returns where they start, for its batches'
+// transform_base. Their quads' indices are relative to it. Content without
+// transforms of its own can use the frame's identity.
+static u32 sdl_append_transforms(TransformStore *transforms) {
+    if (transforms->size == 1) {
+        return 0;
+    }
+    TransformStore *frame = &_APP.transform_store;
+    u32 base = frame->size;
+    if (frame->size + transforms->size > frame->capacity) {
+        frame->capacity = SDL_max(frame->size + transforms->size, frame->capacity * 2);
+        frame->data = realloc(frame->data, frame->capacity * sizeof(GpuTransform));
+    }
+    SDL_memcpy(frame->data + base, transforms->data, transforms->size * sizeof(GpuTransform));
+    frame->size += transforms->size;
+    return base;
+}
+
+// Like sdl_append_transforms, under the current transform. The shader moves
+// quads by the batch offset after their transform, so under a transform the
+// offset is folded into the entries and cleared.
+static u32 sdl_append_transformed(TransformStore *transforms, Vec2 *offset) {
+    if (!sdl_transformed()) {
+        return sdl_append_transforms(transforms);
+    }
+    GpuTransform outer = compose_transforms(_APP.transform, make_transform(M2D(1.0f), (Vec2){0}, *offset));
+    *offset = (Vec2){0};
+    TransformStore *frame = &_APP.transform_store;
+    u32 base = frame->size;
+    if (frame->size + transforms->size > frame->capacity) {
+        frame->capacity = SDL_max(frame->size + transforms->size, frame->capacity * 2);
+        frame->data = realloc(frame->data, frame->capacity * sizeof(GpuTransform));
+    }
+    for (int i = 0; i < transforms->size; i++) {
+        frame->data[base + i] = compose_transforms(outer, transforms->data[i]);
+    }
+    frame->size += transforms->size;
+    return base;
+}
+
+// The transforms quads drawn now index
+static TransformStore *current_transforms() {
+    if (_draw_list) {
+        return &_draw_list->content.transforms;
+    }
+    return _APP.recording ? &_APP.recording->transforms : &_APP.transform_store;
+}
+
+Mat2 rotation_m2(f32 radians) {
+    f32 c = SDL_cosf(radians);
+    f32 s = SDL_sinf(radians);
+    Mat2 m;
+    m.columns[0] = (Vec2){.x = c, .y = s};
+    m.columns[1] = (Vec2){.x = -s, .y = c};
+    return m;
+}
+
+u16 quad_transform(Mat2 m, Vec2 pivot) {
+    GpuTransform t = make_transform(m, pivot, (Vec2){0});
+    if (sdl_transformed()) {
+        t = compose_transforms(_APP.transform, t);
+    }
+    if (transform_is_identity(t)) {
+        return 0;
+    }
+    return add_transform(current_transforms(), t);
+}
+
+void push_transform(Mat2 m, Vec2 pivot, Vec2 offset) {
+    if (_APP.transform_depth == TRANSFORM_STACK_SIZE) {
+        SDL_Log("Transform stack overflow");
+        return;
+    }
+    _APP.transform_stack[_APP.transform_depth] = _APP.local_transform;
+    _APP.transform_depth++;
+    _APP.local_transform = compose_transforms(_APP.local_transform, make_transform(m, pivot, offset));
+    sdl_update_transform();
+}
+
+void pop_transform() {
+    if (_APP.transform_depth > 0) {
+        _APP.transform_depth--;
+        _APP.local_transform = _APP.transform_stack[_APP.transform_depth];
+        sdl_update_transform();
+    }
+}
+
+void set_camera(Vec2 center, f32 zoom, f32 rotation) {
+    Mat2 m = mul_m2f(rotation_m2(rotation), zoom);
+    Vec2 screen_center = {.x = _APP.screen_size.x / 2, .y = _APP.screen_size.y / 2};
+    Vec2 offset = {.x = screen_center.x - center.x, .y = screen_center.y - center.y};
+    _APP.camera = make_transform(m, center, offset);
+    sdl_update_transform();
+}
+
+void reset_camera() {
+    _APP.camera = _APP.transform_store.data[0];
+    sdl_update_transform();
+}
+
+Vec2 screen_to_world(Vec2 point) {
+    if (transform_determinant(_APP.camera) == 0.0f) {
+        return point;
+    }
+    return transform_point(invert_transform(_APP.camera), point);
+}
+
+// The cull rect in the space quads are drawn in. Under a transform that is
+// the bounds of the cull rect mapped back, which is conservative for
+// rotations.
+static Rect current_cull_rect() {
+    if (_draw_list) {
+        return _draw_list->cull_rect;
+    }
+    if (!sdl_transformed()) {
+        return _APP.cull_rect;
+    }
+    if (transform_determinant(_APP.transform) == 0.0f) {
+        return (Rect){-1e30f, -1e30f, 0.0f, 0.0f};
+    }
+    return transform_rect_bounds(_APP.inverse_transform, _APP.cull_rect);
+}
 
-            case SDL_EVENT_MOUSE_BUTTON_DOWN:
-                {
-
-                    Button button = BUTTON_INVALID;
-                    switch (e.button.button) {
-                        case SDL_BUTTON_LEFT: button = BUTTON_LEFT; break;
-                        case SDL_BUTTON_RIGHT: button = BUTTON_RIGHT; break;
-                        case SDL_BUTTON_MIDDLE: button = BUTTON_MIDDLE; break;
-                    }
-                    _APP.input.buttons_down[button] = true;
-                    _APP.input.buttons_pressed[button] = true;
-                }
-                break;
-            case SDL_EVENT_MOUSE_BUTTON_UP:
-                {
-                    Button button = BUTTON_INVALID;
-                    switch (e.button.button) {
-                        case SDL_BUTTON_LEFT: button = BUTTON_LEFT; break;
-                        case SDL_BUTTON_RIGHT: button = BUTTON_RIGHT; break;
-                        case SDL_BUTTON_MIDDLE: button = BUTTON_MIDDLE; break;
-                    }
-                    _APP.input.buttons_down[button] = false;
-                    _APP.input.buttons_released[button] = true;
-                }
-                break;
-            case SDL_EVENT_KEY_DOWN:
-                {
-                    Key key = _APP.input.keymap[e.key.scancode];
-                    _APP.input.keys_down[key] = true;
-                    _APP.input.keys_pressed[key] = true;
-                }
-                break;
-            case SDL_EVENT_MOUSE_MOTION:
-                {
-                    _APP.input.mouse.x = (f32)e.motion.x;
-                    _APP.input.mouse.y = (f32)e.motion.y;
-                }
-                break;
-            case SDL_EVENT_MOUSE_WHEEL:
-                {
-                    _APP.input.wheel.x = (f32)e.wheel.x;
-                    _APP.input.wheel.y = (f32)e.wheel.y;
-                }
-                break;
-            case SDL_EVENT_KEY_UP:
-                {
-                    Key key = _APP.input.keymap[e.key.scancode];
-                    _APP.input.keys_down[key] = false;
-                    _APP.input.keys_released[key] = true;
-                }
-                break;
-            case SDL_EVENT_TEXT_INPUT:
-                {
-                    int i = 0;
-                    while (e.text.text[i] && i < TEXT_BUF_LEN) {
-                        _APP.input.textbuf[i] = e.text.text[i];
-                        i++;
-                    }
-                }
+static void count_culled(int count) {
+    if (_draw_list) {
+        _draw_list->culled_quads += count;
+    } else {
+        _APP.culled_quads += count;
+    }
+}
+
+// Returns true when rect is outside the window or the active clip, and counts
+// it as culled.
+static bool is_culled(Rect rect) {
+    if (rects_intersect(rect, current_cull_rect())) {
+        return false;
+    }
+    count_culled(1);
+    return true;
+}
+
+// Tests four rects against the cull rect at once, returning a bit per visible
+// rect.
+static int visible_rects4(const Rect *rects) {
+    Rect c = current_cull_rect();
+#ifdef HANDMADE_MATH__USE_SSE
+    __m128 x = _mm_loadu_ps(&rects[0].x);
+    __m128 y = _mm_loadu_ps(&rects[1].x);
+    __m128 w = _mm_loadu_ps(&rects[2].x);
+    __m128 h = _mm_loadu_ps(&rects[3].x);
+    _MM_TRANSPOSE4_PS(x, y, w, h);
+    __m128 in_x = _mm_and_ps(_mm_cmplt_ps(x, _mm_set1_ps(c.x + c.w)), _mm_cmpgt_ps(_mm_add_ps(x, w), _mm_set1_ps(c.x)));
+    __m128 in_y = _mm_and_ps(_mm_cmplt_ps(y, _mm_set1_ps(c.y + c.h)), _mm_cmpgt_ps(_mm_add_ps(y, h), _mm_set1_ps(c.y)));
+    return _mm_movemask_ps(_mm_and_ps(in_x, in_y));
+#elif defined(HANDMADE_MATH__USE_NEON)
+    float32x4x4_t r = vld4q_f32(&rects[0].x);
+    uint32x4_t in_x = vandq_u32(vcltq_f32(r.val[0], vdupq_n_f32(c.x + c.w)), vcgtq_f32(vaddq_f32(r.val[0], r.val[2]), vdupq_n_f32(c.x)));
+    uint32x4_t in_y = vandq_u32(vcltq_f32(r.val[1], vdupq_n_f32(c.y + c.h)), vcgtq_f32(vaddq_f32(r.val[1], r.val[3]), vdupq_n_f32(c.y)));
+    uint32x4_t bits = {1, 2, 4, 8};
+    return vaddvq_u32(vandq_u32(vandq_u32(in_x, in_y), bits));
+#else
+    int mask = 0;
+    for (int i = 0; i < 4; i++) {
+        mask |= rects_intersect(rects[i], c) << i;
+    }
+    return mask;
+#endif
+}
+
+void push_clip_rect(Rect rect) {
+    if (_APP.clip_depth == CLIP_STACK_SIZE) {
+        SDL_Log("Clip stack overflow");
+        return;
+    }
+    _APP.clip_stack[_APP.clip_depth] = (ClipState){_APP.cull_rect, _APP.clip};
+    _APP.clip_depth++;
+
+    // Nested clips only ever narrow, and the clip doubles as the cull rect.
+    // Clips are kept on screen, so a rotated one clips to its bounds.
+    _APP.cull_rect = rect_intersection(_APP.cull_rect, sdl_screen_bounds(rect));
+    _APP.clip = -1;
+}
+
+void pop_clip_rect() {
+    if (_APP.clip_depth > 0) {
+        _APP.clip_depth--;
+        _APP.cull_rect = _APP.clip_stack[_APP.clip_depth].rect;
+        _APP.clip = _APP.clip_stack[_APP.clip_depth].index;
+    }
+}
+
+// Adds rect to the frame's clip table, returning its index. When the table
+// is out of flag bits the window's clip is returned instead, and quads fall
+// back to CPU culling only.
+static u32 add_clip(Rect rect) {
+    ClipStore *clips = &_APP.clip_store;
+    if (clips->size == MAX_CLIPS) {
+        return 0;
+    }
+    if (clips->size == clips->capacity) {
+        clips->capacity *= 2;
+        clips->data = realloc(clips->data, clips->capacity * sizeof(Rect));
+    }
+    clips->data[clips->size] = rect;
+    clips->size++;
+    return clips->size - 1;
+}
+
+// Adds the current clip to the frame's clip table the first time it's used
+static u32 current_clip() {
+    if (_APP.clip < 0) {
+        _APP.clip = add_clip(_APP.cull_rect);
+    }
+    return _APP.clip;
+}
+
+// Adds an item to the frame's display list. The caller hashes the item's
+// data; the state it is drawn with is mixed in here, so anything that would
+// change its pixels changes the hash. Texture slots and clip indices depend
+// on batching, so they must be left out of the data.
+static void sdl_track_item(u64 hash, Texture *texture, Rect bounds) {
+    if (_draw_list) {
+        // Texture indices are fixed at load, so they can go in here
+        struct {
+            u64 hash;
+            int texture;
+        } item = {hash, texture ? texture->idx : -1};
+        _draw_list->hash = hash_words(_draw_list->hash, &item, sizeof(item));
+        return;
+    }
+    if (_APP.recording) {
+        return;
+    }
+    struct {
+        Rect clip;
+        int layer;
+        int texture;
+        BlendMode blend;
+        GpuTransform transform;
+    } state = {_APP.cull_rect, _APP.layer, texture ? texture->idx : -1, _APP.blend, _APP.transform};
+    hash = hash_words(hash, &state, sizeof(state));
+    bounds = sdl_screen_bounds(bounds);
+
+    DisplayList *items = &_APP.display_lists[_APP.display_list];
+    if (items->size == items->capacity) {
+        items->capacity = SDL_max(256, items->capacity * 2);
+        items->data = realloc(items->data, items->capacity * sizeof(DisplayItem));
+    }
+    items->data[items->size] = (DisplayItem){hash, bounds};
+    items->size++;
+}
+
+static Batch *push_batch(BatchStore *batches) {
+    if (batches->size == batches->capacity) {
+        batches->capacity *= 2;
+        batches->data = realloc(batches->data, batches->capacity * sizeof(Batch));
+    }
+    Batch *batch = &batches->data[batches->size];
+    batches->size++;
+    *batch = (Batch){0};
+    return batch;
+}
+
+static void push_run(RunStore *runs, u32 key, int first, int count, Rect bounds) {
+    // Extend the current run if it has the same key and stays compact, or
+    // start a new one. Run bounds are what batch merging tests against, so
+    // a run that would mostly grow empty space gets split instead.
+    QuadRun *run = runs->size > 0 ? &runs->data[runs->size - 1] : NULL;
+    Rect run_bounds = run ? rect_union(run->bounds, bounds) : bounds;
+    if (run && run->key == key && rect_area(run_bounds) <= 2.0f * (rect_area(run->bounds) + rect_area(bounds))) {
+        run->count += count;
+        run->bounds = run_bounds;
+        return;
+    }
+
+    if (run && key < run->key) {
+        runs->sorted = false;
+    }
+    if (runs->size == runs->capacity) {
+        runs->capacity *= 2;
+        runs->data = realloc(runs->data, runs->capacity * sizeof(QuadRun));
+        runs->scratch = realloc(runs->scratch, runs->capacity * sizeof(QuadRun));
+    }
+    runs->data[runs->size] = (QuadRun){
+        .key = key,
+        .first = first,
+        .count = count,
+        .bounds = bounds,
+    };
+    runs->size++;
+}
+
+// Returns true if quads of this kind, blend and texture can go in batch, setting
+// the texture's slot in it.
+static bool batch_accepts(Batch *batch, PipelineKind pipeline, BlendMode blend, Texture *texture, int *texture_slot) {
+    // Quads of a submitted draw list are clipped and transformed through the
+    // batch's bases, which would offset those of anything joining it
+    if (batch->source || batch->clip_base != 0 || batch->transform_base != 0 || batch->pipeline != pipeline || batch->blend != blend) {
+        return false;
+    }
+    *texture_slot = texture ? batch_texture_slot(batch, texture) : 0;
+    return *texture_slot >= 0;
+}
+
+// While recording, quads go to the static batch's own memory. Its batches
+// are only split by the pipeline state changing or the texture table filling up;
+// there is nothing to merge with and no clip table to reference.
+static GpuQuad *static_batch_reserve(StaticBatch *sb, PipelineKind pipeline, BlendMode blend, Texture *texture, Rect bounds, int count, f32 area, u32 *flags) {
+    BatchStore *batches = &sb->batches;
+    Batch *batch = batches->size > 0 ? &batches->data[batches->size - 1] : NULL;
+    int texture_slot = 0;
+    if (batch && !batch_accepts(batch, pipeline, blend, texture, &texture_slot)) {
+        batch = NULL;
+    }
+    if (!batch) {
+        batch = push_batch(batches);
+        batch->pipeline = pipeline;
+        batch->blend = blend;
+        batch->first = sb->quad_count;
+        texture_slot = texture ? batch_texture_slot(batch, texture) : 0;
+    }
+
+    if (sb->quad_count + count > sb->quad_capacity) {
+        sb->quad_capacity = SDL_max(sb->quad_count + count, sb->quad_capacity * 2);
+        sb->quads = realloc(sb->quads, sb->quad_capacity * sizeof(GpuQuad));
+    }
+    GpuQuad *quads = sb->quads + sb->quad_count;
+    sb->quad_count += count;
+    batch->count += count;
+    sb->bounds = rect_union(sb->bounds, bounds);
+    sb->area += area;
+    if (pipeline_is_opaque(pipeline)) {
+        sb->opaque_area += area;
+    }
+
+    *flags = texture ? QUAD_TEXTURED | ((u32)texture_slot << QUAD_SLOT_SHIFT) : 0;
+    *flags |= blend_flags(blend);
+    return quads;
+}
+
+// area is the screen area the quads cover, for the overdraw stats
+static GpuQuad *sdl_reserve_quads(PipelineKind pipeline, BlendMode blend, Texture *texture, Rect bounds, int count, f32 area, u32 *flags) {
+    // Only quads that replace what is under them can skip blending, which
+    // additive and multiplied ones don't
+    if (blend == BLEND_ADDITIVE || blend == BLEND_MULTIPLY) {
+        pipeline = blended_pipeline(pipeline);
+    }
+    // Draw lists and static batches are recorded without the benchmarking
+    // switches, which sdl_draw applies when they're drawn. Draw lists are
+    // built on other threads, and static batches outlive the switches.
+    if (_draw_list) {
+        return static_batch_reserve(&_draw_list->content, pipeline, blend, texture, bounds, count, area, flags);
+    }
+    if (_APP.recording) {
+        return static_batch_reserve(_APP.recording, pipeline, blend, texture, bounds, count, area, flags);
+    }
+    pipeline = sdl_pipeline_for(pipeline);
+
+    _APP.drawn_area += area;
+    if (pipeline_is_opaque(pipeline)) {
+        _APP.opaque_area += area;
+    }
+    bounds = sdl_screen_bounds(bounds);
+
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    BatchStore *batches = &_APP.batch_store;
+    RunStore *runs = &_APP.run_store;
+
+    // Quads join the open batch if it has the same pipeline state and room for
+    // their texture. Otherwise they look back for an earlier batch that
+    // does. Joining batch b draws them ahead of every later batch in the
+    // same layer, so b has to be at or past the newest batch they overlap.
+    // Either way the batch has to be in the chunk the quads go in.
+    int first = sdl_chunk_fit(slot->quad_count, count);
+    int chunk = first / QUAD_CHUNK_SIZE;
+    int open = batches->size - 1;
+    Batch *batch = NULL;
+    int texture_slot = 0;
+    if (open >= 0 && batches->data[open].first / QUAD_CHUNK_SIZE == chunk &&
+            batch_accepts(&batches->data[open], pipeline, blend, texture, &texture_slot)) {
+        batch = &batches->data[open];
+    } else if (open > 0) {
+        int lowest = SDL_max(0, open - BATCH_MERGE_LOOKBACK);
+        u32 layer = (u32)_APP.layer;
+
+        // Runs of the batches after the lowest candidate all start at or
+        // after its successor's first run.
+        int first_run = lowest < open ? batches->data[lowest + 1].first_run : runs->size;
+        for (int i = first_run; i < runs->size && lowest < open; i++) {
+            QuadRun *run = &runs->data[i];
+            int run_batch = run->key & RUN_KEY_BATCH_MASK;
+            if (run->key >> RUN_KEY_LAYER_SHIFT == layer && run_batch > lowest && rects_intersect(bounds, run->bounds)) {
+                lowest = run_batch;
+            }
+        }
+
+        for (int i = open - 1; i >= lowest; i--) {
+            if (batches->data[i].first / QUAD_CHUNK_SIZE == chunk && batch_accepts(&batches->data[i], pipeline, blend, texture, &texture_slot)) {
+                batch = &batches->data[i];
                 break;
+            }
         }
+        // The batch's quads are no longer one range, whatever layer these
+        // go in, so they have to be drawn through the order list
+        if (batch) {
+            runs->sorted = false;
+            if (!batch->merged) {
+                batch->merged = true;
+                _APP.merged_batches++;
+            }
+        }
+    }
+
+    if (!batch) {
+        batch = push_batch(batches);
+        batch->pipeline = pipeline;
+        batch->blend = blend;
+        batch->first = first;
+        batch->first_run = runs->size;
+        texture_slot = texture ? batch_texture_slot(batch, texture) : 0;
     }
 
+    u32 key = ((u32)_APP.layer << RUN_KEY_LAYER_SHIFT) | (u32)(batch - batches->data);
+    push_run(runs, key, first, count, bounds);
+
+    GpuQuad *quads = sdl_reserve_frame_quads(slot, first, count);
+    batch->count += count;
+
+    *flags = current_clip() << QUAD_CLIP_SHIFT | blend_flags(blend);
+    if (texture) {
+        *flags |= QUAD_TEXTURED | ((u32)texture_slot << QUAD_SLOT_SHIFT);
+    }
+    return quads;
 }
 
-bool app_should_quit() {
-    sdl_flush();
-    sdl_end_frame();
+GpuQuad *draw_reserve_quads(Texture *texture, Rect bounds, int count, u32 *flags) {
+    if (count > QUAD_CHUNK_SIZE && !_draw_list && !_APP.recording) {
+        SDL_Log("draw_reserve_quads: %d quads don't fit in one chunk", count);
+        return NULL;
+    }
+    // What gets written isn't known here, so frames using this are never
+    // skipped or partially redrawn
+    if (_draw_list) {
+        _draw_list->untracked = true;
+    } else if (!_APP.recording) {
+        _APP.untracked_frame = true;
+    }
+    // Textured quads may be sprites or glyphs, which the sprite shader
+    // draws the same. Untextured ones may have any shape.
+    f32 area = rect_area(rect_intersection(bounds, current_cull_rect()));
+    return sdl_reserve_quads(texture ? PIPELINE_SPRITE : PIPELINE_SDF, current_blend(), texture, bounds, count, area, flags);
+}
 
-    sdl_process_events();
+void set_specialized_pipelines(bool enabled) {
+    _APP.uber_only = !enabled;
+}
 
-    sdl_begin_frame();
-    return _APP.should_quit;
+void set_opaque_pass(bool enabled) {
+    _APP.no_opaque_pass = !enabled;
 }
 
-void app_clear(Color color) {
-    if (_APP.swapchain_texture) {
-        _APP.render_pass = SDL_BeginGPURenderPass(
-            _APP.cmdbuf,
-            &(SDL_GPUColorTargetInfo){
-                .texture = _APP.swapchain_texture,
-                .cycle = false,
-                .load_op = SDL_GPU_LOADOP_CLEAR,
-                .store_op = SDL_GPU_STOREOP_STORE,
-                .clear_color = (SDL_FColor){color.r, color.g, color.b, color.a},
+void set_instanced_quads(bool enabled) {
+    _APP.no_instancing = !enabled;
+}
+
+void set_gpu_culling(bool enabled) {
+    _APP.gpu_culling = enabled;
+}
+
+void set_gpu_cull_check(bool enabled) {
+    _APP.gpu_cull_check = enabled;
+}
+
+StaticBatch *begin_static_batch() {
+    StaticBatch *sb = calloc(1, sizeof(StaticBatch));
+    sb->id = ++_APP.static_batch_count;
+    sb->batches = make_batch_store();
+    sb->transforms = make_transform_store();
+    sb->quad_capacity = 256;
+    sb->quads = malloc(sb->quad_capacity * sizeof(GpuQuad));
+
+    // Record everything, the batch may be drawn anywhere
+    _APP.recording = sb;
+    _APP.recording_cull_rect = _APP.cull_rect;
+    _APP.cull_rect = (Rect){-1e30f, -1e30f, 2e30f, 2e30f};
+    return sb;
+}
+
+void end_static_batch() {
+    StaticBatch *sb = _APP.recording;
+    _APP.recording = NULL;
+    _APP.cull_rect = _APP.recording_cull_rect;
+    if (!sb) {
+        return;
+    }
+
+    if (sb->quad_count > 0) {
+        u32 size = sb->quad_count * sizeof(GpuQuad);
+        SDL_GPUTransferBuffer *transfer_buffer = SDL_CreateGPUTransferBuffer(
+            _APP.gpu,
+            &(SDL_GPUTransferBufferCreateInfo){
+                .usage = SDL_GPU_TRANSFERBUFFERUSAGE_UPLOAD,
+                .size = size,
+            }
+        );
+        ASSERT_CREATED(transfer_buffer);
+        GpuQuad *mapped = SDL_MapGPUTransferBuffer(_APP.gpu, transfer_buffer, false);
+        SDL_memcpy(mapped, sb->quads, size);
+        SDL_UnmapGPUTransferBuffer(_APP.gpu, transfer_buffer);
+
+        sb->buffer = SDL_CreateGPUBuffer(
+            _APP.gpu,
+            &(SDL_GPUBufferCreateInfo){
+                .usage = SDL_GPU_BUFFERUSAGE_GRAPHICS_STORAGE_READ | SDL_GPU_BUFFERUSAGE_COMPUTE_STORAGE_READ,
+                .size = size,
+            }
+        );
+        ASSERT_CREATED(sb->buffer);
+
+        SDL_GPUCommandBuffer *upload_cmd_buf = SDL_AcquireGPUCommandBuffer(_APP.gpu);
+        SDL_GPUCopyPass *copy_pass = SDL_BeginGPUCopyPass(upload_cmd_buf);
+        SDL_UploadToGPUBuffer(
+            copy_pass,
+            &(SDL_GPUTransferBufferLocation){
+                .transfer_buffer = transfer_buffer,
+                .offset = 0,
             },
-            1,
-            NULL
+            &(SDL_GPUBufferRegion){
+                .buffer = sb->buffer,
+                .offset = 0,
+                .size = size,
+            },
+            false
         );
-        SDL_EndGPURenderPass(_APP.render_pass);
+        SDL_EndGPUCopyPass(copy_pass);
+        SDL_SubmitGPUCommandBuffer(upload_cmd_buf);
+        SDL_ReleaseGPUTransferBuffer(_APP.gpu, transfer_buffer);
+    }
+
+    free(sb->quads);
+    sb->quads = NULL;
+}
+
+void draw_static_batch(StaticBatch *sb, Vec2 offset) {
+    if (sb->quad_count == 0 || _APP.recording) {
+        return;
+    }
+    Rect bounds = {sb->bounds.x + offset.x, sb->bounds.y + offset.y, sb->bounds.w, sb->bounds.h};
+    if (!rects_intersect(bounds, current_cull_rect())) {
+        _APP.culled_quads += sb->quad_count;
+        return;
+    }
+
+    struct {
+        u32 id;
+        Vec2 offset;
+    } item = {sb->id, offset};
+    sdl_track_item(hash_words(HASH_SEED, &item, sizeof(item)), NULL, bounds);
+    _APP.drawn_area += sb->area;
+    if (!_APP.uber_only && !_APP.no_opaque_pass) {
+        _APP.opaque_area += sb->opaque_area;
+    }
 
+    // Each of the static batch's batches becomes a frame batch of its own,
+    // keyed like any other so layers and merging treat it in order
+    BatchStore *batches = &_APP.batch_store;
+    u32 clip = current_clip();
+    u32 transform_base = sdl_append_transformed(&sb->transforms, &offset);
+    Rect screen_bounds = sdl_screen_bounds(bounds);
+    for (int i = 0; i < sb->batches.size; i++) {
+        Batch *batch = push_batch(batches);
+        *batch = sb->batches.data[i];
+        batch->first_run = _APP.run_store.size;
+        batch->source = sb;
+        batch->offset = offset;
+        batch->clip_base = clip;
+        batch->transform_base = transform_base;
+
+        u32 key = ((u32)_APP.layer << RUN_KEY_LAYER_SHIFT) | (u32)(batches->size - 1);
+        push_run(&_APP.run_store, key, batch->first, batch->count, screen_bounds);
     }
 }
 
-void push_quad(GpuQuad quad) {
-    if (_APP.last_texture.idx != _APP.rect_texture.idx || 1) {
-        sdl_flush();
-        _APP.last_texture = _APP.rect_texture;
+// The batch may have been drawn this frame, which still reads it at flush,
+// so it is released with the slot's other resources.
+void free_static_batch(StaticBatch *sb) {
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    sb->next_freed = slot->freed_batches;
+    slot->freed_batches = sb;
+}
+
+DrawList *create_draw_list() {
+    DrawList *list = calloc(1, sizeof(DrawList));
+    list->content.batches = make_batch_store();
+    list->content.transforms = make_transform_store();
+    return list;
+}
+
+void begin_draw_list(DrawList *list, Rect cull_rect) {
+    StaticBatch *content = &list->content;
+    content->quad_count = 0;
+    content->batches.size = 0;
+    content->transforms.size = 1;
+    content->bounds = (Rect){0};
+    content->area = 0.0f;
+    content->opaque_area = 0.0f;
+    list->cull_rect = cull_rect;
+    list->culled_quads = 0;
+    list->hash = HASH_SEED;
+    list->untracked = false;
+    _draw_list = list;
+}
+
+void end_draw_list() {
+    _draw_list = NULL;
+}
+
+void submit_draw_list(DrawList *list) {
+    StaticBatch *content = &list->content;
+    if (_APP.recording) {
+        SDL_Log("submit_draw_list: lists can't be submitted while a static batch is recorded");
+        return;
+    }
+    _APP.culled_quads += list->culled_quads;
+    if (content->quad_count == 0) {
+        return;
+    }
+
+    if (list->untracked) {
+        _APP.untracked_frame = true;
+    } else {
+        sdl_track_item(list->hash, NULL, content->bounds);
+    }
+    _APP.drawn_area += content->area;
+    if (!_APP.uber_only && !_APP.no_opaque_pass) {
+        _APP.opaque_area += content->opaque_area;
+    }
+
+    // The list's batches follow the frame's, keyed like any other, and are
+    // copied with one memcpy each. One that doesn't fit in the frame's chunk
+    // is split at the chunk's end. Their quads were recorded without a clip
+    // and take the one active now.
+    FrameSlot *slot = &_APP.frames[_APP.frame_index];
+    BatchStore *batches = &_APP.batch_store;
+    u32 clip = current_clip();
+    Vec2 offset = {0};
+    u32 transform_base = sdl_append_transformed(&content->transforms, &offset);
+    Rect screen_bounds = sdl_screen_bounds(content->bounds);
+    for (int i = 0; i < content->batches.size; i++) {
+        Batch *list_batch = &content->batches.data[i];
+        for (int done = 0; done < list_batch->count;) {
+            int first = sdl_chunk_fit(slot->quad_count, 1);
+            int count = SDL_min(list_batch->count - done, QUAD_CHUNK_SIZE - first % QUAD_CHUNK_SIZE);
+            GpuQuad *quads = sdl_reserve_frame_quads(slot, first, count);
+            SDL_memcpy(quads, content->quads + list_batch->first + done, count * sizeof(GpuQuad));
+
+            Batch *batch = push_batch(batches);
+            *batch = *list_batch;
+            batch->first = first;
+            batch->count = count;
+            batch->first_run = _APP.run_store.size;
+            batch->clip_base = clip;
+            batch->transform_base = transform_base;
+
+            u32 key = ((u32)_APP.layer << RUN_KEY_LAYER_SHIFT) | (u32)(batches->size - 1);
+            push_run(&_APP.run_store, key, first, count, screen_bounds);
+            done += count;
+        }
+    }
+}
+
+void free_draw_list(DrawList *list) {
+    free(list->glyphs.dst);
+    free(list->glyphs.src);
+    free(list->content.quads);
+    free(list->content.batches.data);
+    free(list->content.transforms.data);
+    free(list);
+}
+
+static CachedLayer *sdl_find_cached_layer(u32 id) {
+    CachedLayerStore *layers = &_APP.cached_layers;
+    for (int i = 0; i < layers->size; i++) {
+        if (layers->data[i].id == id) {
+            return &layers->data[i];
+        }
+    }
+    return NULL;
+}
+
+// (Re)creates the layer's textures for rect, at the canvas's pixel density
+static void sdl_create_cached_layer_textures(CachedLayer *layer, Rect rect) {
+    if (layer->texture.handle) {
+        SDL_ReleaseGPUTexture(_APP.gpu, layer->texture.handle);
+        SDL_ReleaseGPUTexture(_APP.gpu, layer->depth_texture);
     }
 
-    VertStore *store = &_APP.vertex_data_store;
+    u32 w = (u32)SDL_clamp(SDL_ceilf(rect.w * _APP.canvas_size.x / _APP.screen_size.x), 1.0f, _APP.canvas_size.x);
+    u32 h = (u32)SDL_clamp(SDL_ceilf(rect.h * _APP.canvas_size.y / _APP.screen_size.y), 1.0f, _APP.canvas_size.y);
+    SDL_GPUTexture *handle = SDL_CreateGPUTexture(
+        _APP.gpu,
+        &(SDL_GPUTextureCreateInfo){
+            .type = SDL_GPU_TEXTURETYPE_2D,
+            .format = SDL_GetGPUSwapchainTextureFormat(_APP.gpu, _APP.window),
+            .width = w,
+            .height = h,
+            .layer_count_or_depth = 1,
+            .num_levels = 1,
+            .usage = SDL_GPU_TEXTUREUSAGE_COLOR_TARGET | SDL_GPU_TEXTUREUSAGE_SAMPLER,
+        }
+    );
+    ASSERT_CREATED(handle);
+    layer->depth_texture = SDL_CreateGPUTexture(
+        _APP.gpu,
+        &(SDL_GPUTextureCreateInfo){
+            .type = SDL_GPU_TEXTURETYPE_2D,
+            .format = _APP.depth_format,
+            .width = w,
+            .height = h,
+            .layer_count_or_depth = 1,
+            .num_levels = 1,
+            .usage = SDL_GPU_TEXTUREUSAGE_DEPTH_STENCIL_TARGET,
+        }
+    );
+    ASSERT_CREATED(layer->depth_texture);
+
+    layer->texture = (Texture){
+        .handle = handle,
+        .w = w,
+        .h = h,
+        .d = 4,
+        .idx = _APP.texture_count++,
+    };
+    layer->valid = false;
+}
+
+bool begin_layer(u32 id, Rect rect) {
+    if (_APP.recording || _APP.active_cached_layer >= 0) {
+        // Layers don't nest and static batches can't hold them, so the
+        // content is drawn as it is
+        _APP.cached_layer_nesting++;
+        return true;
+    }
 
-    if (store->size == store->capacity) {
-        printf("push capacity %d -> %d\n", store->capacity, store->capacity * 2);
-        store->capacity *= 2;
-        store->data = realloc(store->data, store->capacity * sizeof(GpuQuad));
+    CachedLayer *layer = sdl_find_cached_layer(id);
+    if (!layer) {
+        CachedLayerStore *layers = &_APP.cached_layers;
+        if (layers->size == layers->capacity) {
+            layers->capacity = SDL_max(16, layers->capacity * 2);
+            layers->data = realloc(layers->data, layers->capacity * sizeof(CachedLayer));
+        }
+        layer = &layers->data[layers->size];
+        layers->size++;
+        *layer = (CachedLayer){.id = id};
+    }
+    if (!layer->texture.handle || rect.w != layer->rect.w || rect.h != layer->rect.h) {
+        sdl_create_cached_layer_textures(layer, rect);
+    }
+    layer->rect = rect;
+    _APP.active_cached_layer = layer - _APP.cached_layers.data;
+    _APP.cached_layer_clip = (ClipState){_APP.cull_rect, _APP.clip};
+
+    if (layer->valid) {
+        // The content isn't needed; anything drawn anyway is culled
+        _APP.cull_rect = (Rect){0};
+        return false;
     }
 
-    store->data[store->size] = quad;
-    store->size++;
+    if (layer->content) {
+        free_static_batch(layer->content);
+    }
+    layer->content = begin_static_batch();
+    _APP.cull_rect = rect;
+    return true;
 }
 
-void push_textured_quad(Texture *texture, GpuQuad quad) {
-    if (_APP.last_texture.idx != texture->idx) {
-        sdl_flush();
-        _APP.last_texture = *texture;
+void end_layer() {
+    if (_APP.cached_layer_nesting > 0) {
+        _APP.cached_layer_nesting--;
+        return;
+    }
+    if (_APP.active_cached_layer < 0) {
+        return;
+    }
+    CachedLayer *layer = &_APP.cached_layers.data[_APP.active_cached_layer];
+    _APP.active_cached_layer = -1;
+
+    _APP.cull_rect = _APP.cached_layer_clip.rect;
+    _APP.clip = _APP.cached_layer_clip.index;
+    if (!layer->valid) {
+        end_static_batch();
+        layer->valid = true;
+        layer->version++;
+        layer->clip = add_clip((Rect){0, 0, layer->rect.w, layer->rect.h});
+        layer->transform_base = sdl_append_transforms(&layer->content->transforms);
+    }
+
+    if (is_culled(layer->rect)) {
+        return;
     }
 
-    VertStore *store = &_APP.vertex_data_store;
+    // The version stands in for the content, so a redrawn layer damages
+    // the frame
+    struct {
+        u32 id;
+        u32 version;
+        Rect rect;
+    } item = {layer->id, layer->version, layer->rect};
+    sdl_track_item(hash_words(HASH_SEED, &item, sizeof(item)), &layer->texture, layer->rect);
+
+    u32 flags;
+    f32 area = rect_area(rect_intersection(layer->rect, current_cull_rect()));
+    GpuQuad *quad = sdl_reserve_quads(PIPELINE_SPRITE, BLEND_PREMULTIPLIED, &layer->texture, layer->rect, 1, area, &flags);
+    GpuQuad q = {
+        .dst_rect = layer->rect,
+        .color = 0xffffffff,
+        .border_color = 0xffffffff,
+        .transform = current_transform_index(),
+        .flags = flags,
+    };
+    pack_rect_unorm16(q.src_rect, (Rect){0, 0, 1, 1});
+    *quad = q;
+}
+
+void invalidate_layer(u32 id) {
+    CachedLayer *layer = sdl_find_cached_layer(id);
+    if (layer) {
+        layer->valid = false;
+    }
+}
 
-    if (store->size == store->capacity) {
-        printf("push capacity %d -> %d\n", store->capacity, store->capacity * 2);
-        store->capacity *= 2;
-        store->data = realloc(store->data, store->capacity * sizeof(GpuQuad));
+void free_layer(u32 id) {
+    CachedLayer *layer = sdl_find_cached_layer(id);
+    if (!layer || _APP.active_cached_layer >= 0) {
+        return;
     }
+    SDL_ReleaseGPUTexture(_APP.gpu, layer->texture.handle);
+    SDL_ReleaseGPUTexture(_APP.gpu, layer->depth_texture);
+    if (layer->content) {
+        free_static_batch(layer->content);
+    }
+    CachedLayerStore *layers = &_APP.cached_layers;
+    *layer = layers->data[layers->size - 1];
+    layers->size--;
+}
 
-    store->data[store->size] = quad;
-    store->size++;
+// Plain rects can skip blending when they are fully opaque. Rotated ones
+// need the SDF shader to antialias their edges.
+static PipelineKind solid_pipeline(u32 packed_color) {
+    if (sdl_transformed() && (_APP.transform.m.columns[0].y != 0.0f || _APP.transform.m.columns[1].x != 0.0f)) {
+        return PIPELINE_SDF;
+    }
+    return packed_color >> 24 == 255 ? PIPELINE_SOLID_OPAQUE : PIPELINE_SOLID;
 }
 
+// Tracks a single quad and writes it to the frame. q's flags hold only
+// content bits; the batching bits and transform are added after hashing.
+static void sdl_push_quad(PipelineKind pipeline, Texture *texture, GpuQuad q) {
+    sdl_track_item(hash_words(HASH_SEED, &q, sizeof(q)), texture, q.dst_rect);
+
+    u32 flags;
+    f32 area = rect_area(rect_intersection(q.dst_rect, current_cull_rect()));
+    GpuQuad *quad = sdl_reserve_quads(pipeline, current_blend(), texture, q.dst_rect, 1, area, &flags);
+    q.flags |= flags;
+    q.transform = current_transform_index();
+    *quad = q;
+}
 
 void draw_rect(Rect rect, Color color) {
-    GpuQuad quad = {
+    if (is_culled(rect)) {
+        return;
+    }
+    u32 packed = pack_color(color);
+    sdl_push_quad(solid_pipeline(packed), NULL, (GpuQuad){
         .dst_rect = rect,
-        .src_rect = (Rect){0.0f, 0.0f, 1.0f, 1.0f},
-        .corner_radii = {0.0f, 0.0f, 0.0f, 0.0f},
-        .border_color = color,
-        .colors = {color, color, color, color},
-        .edge_softness = 0.0f,
-        .border_thickness = 0.0f,
-        .use_texture = 0.0f,
-    };
-    push_quad(quad);
+        .color = packed,
+        .border_color = packed,
+    });
 }
 
 void draw_border_rect(Rect rect, f32 border, Color color, Color border_color) {
-    GpuQuad quad = {
+    if (is_culled(rect)) {
+        return;
+    }
+    u32 packed = pack_color(color);
+    sdl_push_quad(border > 0.0f ? PIPELINE_SDF : solid_pipeline(packed), NULL, (GpuQuad){
         .dst_rect = rect,
-        .src_rect = (Rect){0.0f, 0.0f, 1.0f, 1.0f},
-        .corner_radii = {0.0f, 0.0f, 0.0f, 0.0f},
-        .border_color = border_color,
-        .colors = {color, color, color, color},
-        .edge_softness = 0.0f,
-        .border_thickness = border,
-        .use_texture = 0.0f,
-    };
-    push_quad(quad);
+        .color = packed,
+        .border_color = pack_color(border_color),
+        .border_thickness = pack_half(border),
+        .flags = border > 0.0f ? QUAD_BORDER : 0,
+    });
 }
 
 void draw_rounded_rect(Rect rect, f32 radius, Color color) {
-    GpuQuad quad = {
+    if (is_culled(rect)) {
+        return;
+    }
+    u32 packed = pack_color(color);
+    u16 r = pack_half(radius);
+    sdl_push_quad(radius > 0.0f ? PIPELINE_SDF : solid_pipeline(packed), NULL, (GpuQuad){
         .dst_rect = rect,
-        .src_rect = (Rect){0.0f, 0.0f, 1.0f, 1.0f},
-        .corner_radii = {radius, radius, radius, radius},
-        .border_color = color,
-        .colors = {color, color, color, color},
-        .edge_softness = 0.0f,
-        .border_thickness = 0.0f,
-        .use_texture = 0.0f,
-    };
-    push_quad(quad);
+        .corner_radii = {r, r, r, r},
+        .color = packed,
+        .border_color = packed,
+    });
 }
 
 void draw_rounded_border_rect(Rect rect, f32 radius, f32 border, Color color, Color border_color) {
-    GpuQuad quad = {
+    if (is_culled(rect)) {
+        return;
+    }
+    u16 r = pack_half(radius);
+    u32 packed = pack_color(color);
+    PipelineKind pipeline = radius > 0.0f || border > 0.0f ? PIPELINE_SDF : solid_pipeline(packed);
+    sdl_push_quad(pipeline, NULL, (GpuQuad){
+        .dst_rect = rect,
+        .corner_radii = {r, r, r, r},
+        .color = packed,
+        .border_color = pack_color(border_color),
+        .border_thickness = pack_half(border),
+        .flags = border > 0.0f ? QUAD_BORDER : 0,
+    });
+}
+
+void draw_segment(Vec2 a, Vec2 b, f32 thickness, LineCap cap, Color color) {
+    // Room for square caps at any angle and the antialiased edge
+    f32 pad = thickness * 0.71f + 1.0f;
+    Rect rect = {
+        SDL_min(a.x, b.x) - pad,
+        SDL_min(a.y, b.y) - pad,
+        SDL_fabsf(b.x - a.x) + 2.0f * pad,
+        SDL_fabsf(b.y - a.y) + 2.0f * pad,
+    };
+    if (is_culled(rect)) {
+        return;
+    }
+    u32 packed = pack_color(color);
+    GpuQuad q = {
         .dst_rect = rect,
-        .src_rect = (Rect){0.0f, 0.0f, 1.0f, 1.0f},
-        .corner_radii = {radius, radius, radius, radius},
-        .border_color = border_color,
-        .colors = {color, color, color, color},
-        .edge_softness = 0.0f,
-        .border_thickness = border,
-        .use_texture = 0.0f,
+        .color = packed,
+        .border_color = packed,
+        .border_thickness = pack_half(thickness),
+        .flags = QUAD_PRIM_LINE | ((u32)cap << QUAD_CAP_SHIFT),
     };
-    push_quad(quad);
+    pack_rect_unorm16(q.src_rect, (Rect){
+        (a.x - rect.x) / rect.w,
+        (a.y - rect.y) / rect.h,
+        (b.x - rect.x) / rect.w,
+        (b.y - rect.y) / rect.h,
+    });
+    sdl_push_quad(PIPELINE_SDF, NULL, q);
+}
+
+void draw_polyline(Vec2 *points, int count, f32 thickness, Color color) {
+    for (int i = 0; i + 1 < count; i++) {
+        draw_segment(points[i], points[i + 1], thickness, LINE_CAP_ROUND, color);
+    }
+}
+
+void draw_arc(Vec2 center, f32 radius, f32 thickness, f32 start, f32 sweep, Color color) {
+    Rect rect = {center.x - radius - 1.0f, center.y - radius - 1.0f, 2.0f * radius + 2.0f, 2.0f * radius + 2.0f};
+    if (is_culled(rect)) {
+        return;
+    }
+    if (sweep < 0.0f) {
+        start += sweep;
+        sweep = -sweep;
+    }
+    // Angles are stored as halves, which are only precise near zero
+    start = SDL_fmodf(start, 2.0f * SDL_PI_F);
+    sweep = SDL_min(sweep, 2.0f * SDL_PI_F);
+
+    u32 packed = pack_color(color);
+    sdl_push_quad(PIPELINE_SDF, NULL, (GpuQuad){
+        .dst_rect = rect,
+        .corner_radii = {pack_half(start), pack_half(sweep)},
+        .color = packed,
+        .border_color = packed,
+        .border_thickness = pack_half(thickness),
+        .flags = QUAD_PRIM_ARC,
+    });
+}
+
+void draw_circle(Vec2 center, f32 radius, Color color) {
+    draw_arc(center, radius, 0.0f, 0.0f, 2.0f * SDL_PI_F, color);
 }
 
 void draw_texture(Texture *texture, Rect src, Rect dst) {
-    Color color = {1.0f, 1.0f, 1.0f, 1.0f};
+    if (is_culled(dst)) {
+        return;
+    }
+    src.x = src.x / texture->w;
+    src.y = src.y / texture->h;
     src.w = src.w / texture->w;
     src.h = src.h / texture->h;
-    GpuQuad quad = {
+    GpuQuad q = {
         .dst_rect = dst,
-        .src_rect = src,
-        .corner_radii = {0.0f, 0.0f, 0.0f, 0.0f},
-        .border_color = color,
-        .colors = {color, color, color, color},
-        .edge_softness = 0.0f,
-        .border_thickness = 0.0f,
-        .use_texture = 1.0f,
+        .color = 0xffffffff,
+        .border_color = 0xffffffff,
     };
-    push_textured_quad(texture, quad);
+    pack_rect_unorm16(q.src_rect, src);
+    sdl_push_quad(texture->opaque ? PIPELINE_SPRITE_OPAQUE : PIPELINE_SPRITE, texture, q);
 }
 
-void draw_text(Font *font, const char *text, float x, float y, Color color) {
-    /* u8 r, g, b, a; */
+// Like sdl_push_quad for a quad transformed by t, which it is culled and
+// tracked by. Edges that aren't axis aligned need antialiasing, so untextured
+// quads take the SDF pipeline.
+static void sdl_push_transformed_quad(Texture *texture, GpuQuad q, GpuTransform t) {
+    Rect bounds = transform_rect_bounds(t, q.dst_rect);
+    if (is_culled(bounds)) {
+        return;
+    }
+    u64 hash = hash_words(HASH_SEED, &q, sizeof(q));
+    sdl_track_item(hash_words(hash, &t, sizeof(t)), texture, bounds);
 
+    PipelineKind pipeline = PIPELINE_SDF;
+    if (texture) {
+        pipeline = texture->opaque ? PIPELINE_SPRITE_OPAQUE : PIPELINE_SPRITE;
+    }
+    f32 area = SDL_min(SDL_fabsf(transform_determinant(t)) * rect_area(q.dst_rect), rect_area(rect_intersection(bounds, current_cull_rect())));
+    u32 flags;
+    q.transform = add_transform(current_transforms(), sdl_transformed() ? compose_transforms(_APP.transform, t) : t);
+    GpuQuad *quad = sdl_reserve_quads(pipeline, current_blend(), texture, bounds, 1, area, &flags);
+    q.flags |= flags;
+    *quad = q;
+}
+
+void draw_rounded_rect_transformed(Rect rect, f32 radius, Mat2 m, Vec2 pivot, Color color) {
+    GpuTransform t = make_transform(m, pivot, (Vec2){0});
+    if (transform_is_identity(t)) {
+        draw_rounded_rect(rect, radius, color);
+        return;
+    }
+    u32 packed = pack_color(color);
+    u16 r = pack_half(radius);
+    sdl_push_transformed_quad(NULL, (GpuQuad){
+        .dst_rect = rect,
+        .corner_radii = {r, r, r, r},
+        .color = packed,
+        .border_color = packed,
+    }, t);
+}
+
+void draw_texture_transformed(Texture *texture, Rect src, Rect dst, Mat2 m, Vec2 pivot) {
+    GpuTransform t = make_transform(m, pivot, (Vec2){0});
+    if (transform_is_identity(t)) {
+        draw_texture(texture, src, dst);
+        return;
+    }
+    src.x = src.x / texture->w;
+    src.y = src.y / texture->h;
+    src.w = src.w / texture->w;
+    src.h = src.h / texture->h;
+    GpuQuad q = {
+        .dst_rect = dst,
+        .color = 0xffffffff,
+        .border_color = 0xffffffff,
+    };
+    pack_rect_unorm16(q.src_rect, src);
+    sdl_push_transformed_quad(texture, q, t);
+}
+
+void draw_text(Font *font, const char *text, float x, float y, Color color) {
+    // Glyphs sit within about a line height of the baseline, so a line well
+    // outside the cull rect is skipped without laying it out.
     y += font->scale;
-    while (*text) {
-        if (*text >= 32 && *text < 128) {
+    Rect cull = current_cull_rect();
+    if (y + 2.0f * font->scale < cull.y || y - 2.0f * font->scale > cull.y + cull.h) {
+        int count = 0;
+        for (const char *c = text; *c; c++) {
+            count += *c >= 32 && *c < 128;
+        }
+        count_culled(count);
+        return;
+    }
+
+    // Lay the string out into scratch space, padded to a multiple of four
+    // for the culling below
+    int len = (int)strlen(text);
+    GlyphScratch *scratch = _draw_list ? &_draw_list->glyphs : &_APP.glyphs;
+    if (scratch->capacity < len + 4) {
+        scratch->capacity = SDL_max(len + 4, scratch->capacity * 2);
+        scratch->dst = realloc(scratch->dst, scratch->capacity * sizeof(Rect));
+        scratch->src = realloc(scratch->src, scratch->capacity * sizeof(Rect));
+    }
+    Rect *glyph_dst = scratch->dst;
+    Rect *glyph_src = scratch->src;
+
+    int count = 0;
+    for (const char *c = text; *c; c++) {
+        if (*c >= 32 && *c < 128) {
             stbtt_aligned_quad quad;
-            stbtt_GetPackedQuad(font->char_data, ATLAS_WIDTH, ATLAS_HEIGHT, *text - 32, &x, &y, &quad, 1);
+            stbtt_GetPackedQuad(font->char_data, ATLAS_WIDTH, ATLAS_HEIGHT, *c - 32, &x, &y, &quad, 1);
+            glyph_dst[count] = (Rect){quad.x0, quad.y0, quad.x1 - quad.x0, quad.y1 - quad.y0};
+            glyph_src[count] = (Rect){quad.s0, quad.t0, quad.s1 - quad.s0, quad.t1 - quad.t0};
+            count++;
+        }
+    }
+    for (int i = count; i < count + 4; i++) {
+        glyph_dst[i] = (Rect){0};
+    }
+
+    // Drop glyphs outside the cull rect four at a time, compacting the rest
+    int visible = 0;
+    Rect bounds = {0};
+    f32 area = 0.0f;
+    for (int i = 0; i < count; i += 4) {
+        int mask = visible_rects4(&glyph_dst[i]);
+        for (int j = i; mask && j < count; j++, mask >>= 1) {
+            if (mask & 1) {
+                bounds = rect_union(bounds, glyph_dst[j]);
+                area += rect_area(glyph_dst[j]);
+                glyph_dst[visible] = glyph_dst[j];
+                glyph_src[visible] = glyph_src[j];
+                visible++;
+            }
+        }
+    }
+    count_culled(count - visible);
+    if (visible == 0) {
+        return;
+    }
 
+    u32 packed = pack_color(color);
+    u64 hash = hash_words(HASH_SEED, &packed, sizeof(packed));
+    hash = hash_words(hash, glyph_dst, visible * sizeof(Rect));
+    hash = hash_words(hash, glyph_src, visible * sizeof(Rect));
+    sdl_track_item(hash, &font->texture, bounds);
+
+    // A reservation can't be bigger than a chunk
+    u16 transform = current_transform_index();
+    for (int first = 0; first < visible; first += QUAD_CHUNK_SIZE) {
+        int count = SDL_min(visible - first, QUAD_CHUNK_SIZE);
+        u32 flags;
+        GpuQuad *quads = sdl_reserve_quads(PIPELINE_GLYPH, current_blend(), &font->texture, bounds, count, area * count / visible, &flags);
+        for (int i = 0; i < count; i++) {
             GpuQuad gpu_quad = {
-                .dst_rect = (Rect){quad.x0, quad.y0, quad.x1 - quad.x0, quad.y1 - quad.y0},
-                .src_rect = (Rect){quad.s0, quad.t0, (quad.s1 - quad.s0), (quad.t1 - quad.t0)},
-                .corner_radii = {0.0f, 0.0f, 0.0f, 0.0f},
-                .border_color = {1.0f, 1.0f, 1.0f, 1.0f},
-                .colors = {color, color, color, color},
-                .edge_softness = 1.0f,
-                .border_thickness = 1.0f,
-                .use_texture = 1.0f,
+                .dst_rect = glyph_dst[first + i],
+                .color = packed,
+                .border_color = 0xffffffff,
+                .transform = transform,
+                .flags = flags,
             };
-            push_textured_quad(&(font->texture), gpu_quad);
+            pack_rect_unorm16(gpu_quad.src_rect, glyph_src[first + i]);
+            quads[i] = gpu_quad;
         }
-        text++;
     }
 }
 